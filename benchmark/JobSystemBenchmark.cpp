@@ -0,0 +1,110 @@
+#include "Util/JobSystem.h"
+#include "Util/Util.h"
+
+#include <fmt/format.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Benchmarks the job system with flat and nested parallel fors of small work items.
+// Prints one csv row per scenario so that results can be compared between builds.
+
+namespace
+{
+	struct BenchmarkData
+	{
+		JobSystem* job_system;
+		std::vector<uint64_t> values;
+		std::atomic_uint64_t total = 0;
+		size_t inner_count = 0;
+	};
+
+	void SumRange(void* userdata, size_t begin, size_t end)
+	{
+		BenchmarkData* data = static_cast<BenchmarkData*>(userdata);
+
+		uint64_t total = 0;
+
+		for (size_t i = begin; i < end; i++)
+		{
+			total += data->values[i] * data->values[i];
+		}
+
+		data->total.fetch_add(total, std::memory_order_relaxed);
+	}
+
+	// Each item starts its own parallel for and waits on it
+	void NestedRange(void* userdata, size_t begin, size_t end)
+	{
+		BenchmarkData* data = static_cast<BenchmarkData*>(userdata);
+
+		for (size_t i = begin; i < end; i++)
+		{
+			JobSystem::Group group;
+			data->job_system->ParallelFor(group, data->inner_count, &SumRange, data);
+			data->job_system->Wait(group);
+		}
+	}
+
+	void PrintResult(std::string_view scenario, size_t thread_count, size_t operations, double seconds)
+	{
+		fmt::print("{},{},{},{:.6f},{:.0f}\n", scenario, thread_count, operations, seconds, operations / seconds);
+	}
+
+	void RunBenchmark(size_t thread_count, size_t count, size_t repeats)
+	{
+		JobSystem job_system(thread_count - 1);
+
+		BenchmarkData data;
+		data.job_system = &job_system;
+		data.values.resize(count);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			data.values[i] = i;
+		}
+
+		Clock::time_point start = Clock::now();
+
+		for (size_t i = 0; i < repeats; i++)
+		{
+			JobSystem::Group group;
+			job_system.ParallelFor(group, count, &SumRange, &data);
+			job_system.Wait(group);
+		}
+
+		PrintResult("parallel_for", thread_count, count * repeats, std::chrono::duration<double>(Clock::now() - start).count());
+
+		data.inner_count = count / 1000;
+
+		start = Clock::now();
+
+		for (size_t i = 0; i < repeats; i++)
+		{
+			JobSystem::Group group;
+			job_system.ParallelFor(group, 1000, &NestedRange, &data, 1);
+			job_system.Wait(group);
+		}
+
+		PrintResult("nested", thread_count, data.inner_count * 1000 * repeats, std::chrono::duration<double>(Clock::now() - start).count());
+	}
+}
+
+// Usage: JobSystemBenchmark [count] [repeats] [max threads]
+int main(int argc, char** argv)
+{
+	size_t count = argc > 1 ? std::stoull(argv[1]) : 1000000;
+	size_t repeats = argc > 2 ? std::stoull(argv[2]) : 100;
+	size_t max_threads = argc > 3 ? std::stoull(argv[3]) : std::thread::hardware_concurrency();
+
+	fmt::print("scenario,threads,operations,seconds,operations_per_second\n");
+
+	for (size_t thread_count = 1; thread_count <= max_threads; thread_count *= 2)
+	{
+		RunBenchmark(thread_count, count, repeats);
+	}
+
+	return 0;
+}
\ No newline at end of file
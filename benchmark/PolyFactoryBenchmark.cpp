@@ -0,0 +1,145 @@
+#include "Util/PolyFactory.h"
+#include "Util/UUID.h"
+#include "Util/Util.h"
+
+#include <fmt/format.h>
+
+#include <thread>
+#include <vector>
+#include <random>
+#include <string>
+
+// Benchmarks creating and finding polys in a PolyFactory from many threads at once.
+// Prints one csv row per scenario so that results can be compared between builds.
+
+namespace
+{
+	struct CValue
+	{
+		uint64_t value = 0;
+	};
+
+	struct BenchmarkFactory : PolyFactory<BenchmarkFactory, 8, UUID> {};
+
+	using Archetype = BenchmarkFactory::Archetype;
+}
+
+const size_t first = __LINE__ + 1;
+template<> template<> const size_t Archetype::k_type_index<Archetype::Header> =	__LINE__ - first;
+template<> template<> const size_t Archetype::k_type_index<CValue> =			__LINE__ - first;
+
+const std::array<PolyTypeInfo, 8> Archetype::k_type_info =
+{
+	MakeTypeInfo<Archetype::Header>(),
+	MakeTypeInfo<CValue>(),
+};
+
+namespace
+{
+	// Run the function on the given number of threads and return how long they all took
+	template<class Func>
+	double RunThreads(size_t thread_count, Func&& func)
+	{
+		std::vector<std::thread> threads;
+
+		Clock::time_point start = Clock::now();
+
+		for (size_t i = 0; i < thread_count; i++)
+		{
+			threads.emplace_back(func, i);
+		}
+
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	void PrintResult(std::string_view scenario, size_t thread_count, size_t operations, double seconds)
+	{
+		fmt::print("{},{},{},{:.6f},{:.0f}\n", scenario, thread_count, operations, seconds, operations / seconds);
+	}
+
+	void RunBenchmark(size_t thread_count, size_t count, size_t lookups, bool chunked)
+	{
+		BenchmarkFactory factory;
+
+		if (chunked)
+		{
+			factory.UseChunkedStorage<CValue>();
+		}
+
+		std::vector<UUID> ids(count);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			ids[i] = UUID(i + 1, (i + 1) * 0x9E3779B97F4A7C15ull);
+		}
+
+		std::vector<std::vector<BenchmarkFactory::Ref>> refs(thread_count);
+
+		size_t per_thread = count / thread_count;
+
+		double create_seconds = RunThreads(thread_count, [&](size_t thread_index)
+		{
+			std::vector<BenchmarkFactory::Ref>& thread_refs = refs[thread_index];
+
+			thread_refs.reserve(per_thread);
+
+			for (size_t i = thread_index * per_thread; i < (thread_index + 1) * per_thread; i++)
+			{
+				thread_refs.push_back(factory.GetPoly(ids[i], Archetype::CreateTypeID<CValue>()));
+			}
+		});
+
+		PrintResult("create", thread_count, per_thread * thread_count, create_seconds);
+
+		double lookup_seconds = RunThreads(thread_count, [&](size_t thread_index)
+		{
+			std::mt19937_64 rng(thread_index);
+
+			uint64_t total = 0;
+
+			for (size_t i = 0; i < lookups; i++)
+			{
+				BenchmarkFactory::Ref ref = factory.GetPoly(ids[rng() % (per_thread * thread_count)]);
+
+				total += ref->*&CValue::value;
+			}
+
+			DEBUG_ASSERT(total == 0, "The values should be untouched");
+		});
+
+		PrintResult("lookup", thread_count, lookups * thread_count, lookup_seconds);
+
+		refs.clear();
+
+		Clock::time_point cleanup_start = Clock::now();
+
+		factory.Cleanup();
+
+		PrintResult("cleanup", thread_count, per_thread * thread_count, std::chrono::duration<double>(Clock::now() - cleanup_start).count());
+
+		DEBUG_ASSERT(factory.GetCount() == 0, "We should have destroyed all polys");
+	}
+}
+
+// Usage: PolyFactoryBenchmark [count] [lookups per thread] [max threads] [chunked|individual]
+int main(int argc, char** argv)
+{
+	size_t count = argc > 1 ? std::stoull(argv[1]) : 200000;
+	size_t lookups = argc > 2 ? std::stoull(argv[2]) : 1000000;
+	size_t max_threads = argc > 3 ? std::stoull(argv[3]) : std::thread::hardware_concurrency();
+	bool chunked = argc > 4 ? std::string_view(argv[4]) != "individual" : true;
+
+	fmt::print("scenario,threads,operations,seconds,operations_per_second\n");
+
+	for (size_t thread_count = 1; thread_count <= max_threads; thread_count *= 2)
+	{
+		RunBenchmark(thread_count, count, lookups, chunked);
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+# Runs the simulation headless with scripted scenarios and prints one csv row per scenario.
+# The full results including per module timings are written as json when an output path is given.
+#
+# Usage: godot --headless --path VoxelGameDemo --script <path to this file> -- [universes=1] [galaxies=1,4,16] [ticks=1000] [workers=-1] [output=results.json]
+extends SceneTree
+
+func _init() -> void:
+	var options := {
+		"universes": "1",
+		"galaxies": "1,4,16",
+		"ticks": "1000",
+		"workers": "-1",
+		"output": "",
+	}
+
+	for arg in OS.get_cmdline_user_args():
+		var parts := arg.split("=", true, 1)
+		if parts.size() == 2 and options.has(parts[0]):
+			options[parts[0]] = parts[1]
+		else:
+			printerr("Unknown argument: ", arg)
+			quit(1)
+			return
+
+	var results := []
+
+	print("universes,galaxies,ticks,workers,entities,seconds,p50_ms,p95_ms,p99_ms,max_ms")
+
+	for universe_count in options["universes"].split(","):
+		for galaxy_count in options["galaxies"].split(","):
+			var result: Dictionary = UniverseServer.run_benchmark("user://benchmark", int(universe_count), int(galaxy_count), int(options["ticks"]), int(options["workers"]))
+
+			if result.is_empty():
+				quit(1)
+				return
+
+			var ticks: Dictionary = result["ticks"]
+
+			print("%d,%d,%d,%d,%d,%.6f,%.3f,%.3f,%.3f,%.3f" % [
+				result["universes"], result["galaxies"], ticks["count"], result["workers"], result["entities"],
+				result["seconds"], ticks.get("p50", 0.0), ticks.get("p95", 0.0), ticks.get("p99", 0.0), ticks.get("max", 0.0)])
+
+			results.push_back(result)
+
+	if options["output"] != "":
+		var file := FileAccess.open(options["output"], FileAccess.WRITE)
+		if file == null:
+			printerr("Failed to open ", options["output"])
+			quit(1)
+			return
+
+		file.store_string(JSON.stringify(results, "    "))
+
+	quit(0)
\ No newline at end of file
@@ -193,7 +193,7 @@ namespace voxel_game
 		uint8_t dist_per_lod = 0; // The number of nodes there are until the next lod starts
 		uint8_t min_lod = 0; // The minimum lod this camera can see
 		uint8_t max_lod = 0; // The maximum lod this camera can see
-		uint8_t update_frequency = 0; // The frequency
+		uint8_t update_frequency = 0; // The number of frames between each update. 0 and 1 update every frame
 	};
 
 	// Add this component to a child of a scale marker to signify it represents a region in that world
@@ -205,12 +205,16 @@ namespace voxel_game
 	// An entity which is in a spatial world. It will be given a node its part of and loaded/unloaded with that node
 	struct CEntity
 	{
+		constexpr static bool k_no_snapshot = true; // The world pointer is only valid in this process
+
 		spatial3d::WorldPtr parent_world;
 	};
 
 	// A spatial database which has an octree like structure with neighbour pointers and hash maps for each lod. 
 	struct CWorld
 	{
+		constexpr static bool k_no_snapshot = true; // The world pointer is only valid in this process
+
 		WorldConstructType type;
 		spatial3d::WorldPtr world;
 	};
@@ -17,6 +17,8 @@ namespace voxel_game::entity
 	using Ptr = Factory::Ptr;
 	using WRef = Factory::WeakRef;
 	using Ref = Factory::Ref;
+	using Handle = Factory::Handle;
+	using Prefab = Factory::Prefab;
 }
 
 namespace std
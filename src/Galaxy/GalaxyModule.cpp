@@ -16,15 +16,7 @@
 
 namespace voxel_game::galaxy
 {
-	const entity::TypeID k_galaxy_type = entity::Factory::Archetype::CreateTypeID<
-		CGalaxy,
-		CRelationship,
-		CPosition,
-		CRotation,
-		CEntity,
-		CLoader,
-		CTransform
-	>();
+	const entity::TypeID k_galaxy_type = GalaxyType::GetID();
 
 	const entity::TypeID k_simulated_galaxy_type = entity::Factory::Archetype::CreateTypeID<
 #if defined(DEBUG_ENABLED)
@@ -81,6 +73,7 @@ namespace voxel_game::galaxy
 	void Initialize(Simulation& simulation)
 	{
 		simulation.galaxy_type.node_type.AddType<spatial3d::Node>();
+		simulation.galaxy_type.node_type.AddType<spatial3d::LinkedNode>();
 		simulation.galaxy_type.node_type.AddType<spatial3d::PartialNode>();
 		simulation.galaxy_type.node_type.AddType<spatial3d::LocalNode>();
 		simulation.galaxy_type.node_type.AddType<spatial3d::RemoteNode>();
@@ -104,6 +97,10 @@ namespace voxel_game::galaxy
 		simulation.galaxy_type.scale_updates.push_back(&debugrender::ScaleUpdate);
 		simulation.galaxy_type.scale_updates.push_back(&universe::ScaleUpdate);
 
+		simulation.entity_factory.UseStaticType<GalaxyType>();
+
+		simulation.galaxy_prefab = std::make_unique<entity::Prefab>(k_galaxy_type);
+
 		simulation.entity_factory.AddCallback<CGalaxy>(PolyEvent::MainUpdate, cb::BindArg<&OnUpdateGalaxyEntity>(simulation));
 		simulation.entity_factory.AddCallback<CGalaxy>(PolyEvent::BeginLoad, cb::BindArg<&OnLoadGalaxyEntity>(simulation));
 		simulation.entity_factory.AddCallback<CGalaxy>(PolyEvent::BeginUnload, cb::BindArg<&OnUnloadGalaxyEntity>(simulation));
@@ -112,6 +109,7 @@ namespace voxel_game::galaxy
 	void Uninitialize(Simulation& simulation)
 	{
 		simulation.galaxies.clear();
+		simulation.galaxy_prefab.reset();
 	}
 
 	bool IsUnloadDone(Simulation& simulation)
@@ -12,10 +12,29 @@ namespace godot
 namespace voxel_game
 {
 	struct Simulation;
+
+	struct CGalaxy;
+	struct CRelationship;
+	struct CPosition;
+	struct CRotation;
+	struct CEntity;
+	struct CLoader;
+	struct CTransform;
 }
 
 namespace voxel_game::galaxy
 {
+	// Galaxies have a fixed layout so their components can be accessed with constant offsets
+	using GalaxyType = StaticPolyType<entity::Factory::Archetype,
+		CGalaxy,
+		CRelationship,
+		CPosition,
+		CRotation,
+		CEntity,
+		CLoader,
+		CTransform
+	>;
+
 	extern const entity::TypeID k_galaxy_type;
 	extern const entity::TypeID k_simulated_galaxy_type;
 
@@ -1,4 +1,5 @@
 #include "Modules.h"
+#include "UniverseSimulation.h"
 
 #include "Simulation/SimulationModule.h"
 #include "Render/RenderModule.h"
@@ -11,6 +12,7 @@ namespace voxel_game
 {
 	const Module simulation_module_schematic =
 	{
+		"Simulation",
 		&simulation::Initialize,
 		&simulation::Uninitialize,
 		&simulation::IsUnloadDone,
@@ -20,6 +22,7 @@ namespace voxel_game
 
 	const Module rendering_module_schematic =
 	{
+		"Rendering",
 		&rendering::Initialize,
 		&rendering::Uninitialize,
 		&rendering::IsUnloadDone,
@@ -29,6 +32,7 @@ namespace voxel_game
 
 	const Module debugrender_module_schematic =
 	{
+		"DebugRender",
 		&debugrender::Initialize,
 		&debugrender::Uninitialize,
 		&debugrender::IsUnloadDone,
@@ -38,6 +42,7 @@ namespace voxel_game
 
 	const Module spatial3d_module_schematic =
 	{
+		"Spatial3D",
 		&spatial3d::Initialize,
 		&spatial3d::Uninitialize,
 		&spatial3d::IsUnloadDone,
@@ -47,6 +52,7 @@ namespace voxel_game
 
 	const Module universe_module_schematic =
 	{
+		"Universe",
 		&universe::Initialize,
 		&universe::Uninitialize,
 		&universe::IsUnloadDone,
@@ -56,10 +62,21 @@ namespace voxel_game
 
 	const Module galaxy_module_schematic =
 	{
+		"Galaxy",
 		&galaxy::Initialize,
 		&galaxy::Uninitialize,
 		&galaxy::IsUnloadDone,
 		&galaxy::Update,
 		&galaxy::WorkerUpdate
 	};
+
+	void AddSimulationModules(Simulation& simulation)
+	{
+		simulation.modules.push_back(simulation_module_schematic);
+		simulation.modules.push_back(rendering_module_schematic);
+		simulation.modules.push_back(debugrender_module_schematic);
+		simulation.modules.push_back(spatial3d_module_schematic);
+		simulation.modules.push_back(universe_module_schematic);
+		simulation.modules.push_back(galaxy_module_schematic);
+	}
 }
\ No newline at end of file
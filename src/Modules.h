@@ -3,14 +3,20 @@
 namespace voxel_game
 {
 	struct Simulation;
+	struct FrameSchedule;
 
 	struct Module
 	{
+		const char* name;
+
 		void(*initialize)(Simulation&);
 		void(*uninitialize)(Simulation&);
 		bool(*is_unload_done)(Simulation&);
 		void(*update)(Simulation&);
 		void(*worker_update)(Simulation&, size_t);
+
+		// Optional. Adds the module's own jobs to the frame with the resources they read and write
+		void(*schedule)(Simulation&, FrameSchedule&) = nullptr;
 	};
 
 	extern const Module simulation_module_schematic;
@@ -19,4 +25,7 @@ namespace voxel_game
 	extern const Module spatial3d_module_schematic;
 	extern const Module universe_module_schematic;
 	extern const Module galaxy_module_schematic;
+
+	// Add the modules that every universe simulation runs
+	void AddSimulationModules(Simulation& simulation);
 }
\ No newline at end of file
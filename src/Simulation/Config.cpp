@@ -1,13 +1,135 @@
 #include "Config.h"
 
 #include "Util/Debug.h"
+#include "Util/Util.h"
 
+#include <godot_cpp/classes/dir_access.hpp>
 #include <godot_cpp/classes/file_access.hpp>
 #include <godot_cpp/classes/json.hpp>
 #include <godot_cpp/classes/os.hpp>
 
+#include <algorithm>
+#include <memory>
+
 namespace voxel_game::simulation
 {
+	// How long the writer waits for more saves after the first one before writing
+	const auto k_config_write_delay = 1s;
+
+	static std::unique_ptr<ConfigWriter> config_writer;
+
+	ConfigWriter::ConfigWriter()
+	{
+		// Started here so that everything the thread uses is initialized first
+		m_thread = std::thread(&ConfigWriter::ThreadLoop, this);
+	}
+
+	ConfigWriter::~ConfigWriter()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_running = false;
+		}
+
+		m_condition.notify_all();
+
+		// The thread writes whatever is still queued before stopping
+		m_thread.join();
+	}
+
+	void ConfigWriter::Queue(const godot::String& path, const godot::String& text)
+	{
+		{
+			std::lock_guard lock(m_mutex);
+
+			auto it = std::find_if(m_pending.begin(), m_pending.end(), [&path](const auto& pending) { return pending.first == path; });
+
+			if (it != m_pending.end())
+			{
+				it->second = text;
+			}
+			else
+			{
+				m_pending.push_back({ path, text });
+			}
+		}
+
+		m_condition.notify_all();
+	}
+
+	void ConfigWriter::Flush()
+	{
+		std::unique_lock lock(m_mutex);
+
+		m_flush_requested = true;
+		m_condition.notify_all();
+
+		m_condition.wait(lock, [this]() { return m_pending.empty() && !m_writing; });
+
+		m_flush_requested = false;
+	}
+
+	void ConfigWriter::ThreadLoop()
+	{
+		std::unique_lock lock(m_mutex);
+
+		while (true)
+		{
+			m_condition.wait(lock, [this]() { return !m_pending.empty() || !m_running; });
+
+			if (m_pending.empty())
+			{
+				break;
+			}
+
+			// Give a burst of saves a moment to merge unless someone is waiting on them
+			if (m_running && !m_flush_requested)
+			{
+				m_condition.wait_for(lock, k_config_write_delay, [this]() { return m_flush_requested || !m_running; });
+			}
+
+			std::vector<std::pair<godot::String, godot::String>> pending = std::move(m_pending);
+			m_pending.clear();
+
+			m_writing = true;
+
+			lock.unlock();
+
+			for (auto&& [path, text] : pending)
+			{
+				Write(path, text);
+			}
+
+			lock.lock();
+
+			m_writing = false;
+
+			m_condition.notify_all();
+		}
+	}
+
+	void ConfigWriter::Write(const godot::String& path, const godot::String& text)
+	{
+		godot::String temp_path = path + ".tmp";
+
+		godot::Ref<godot::FileAccess> file = godot::FileAccess::open(temp_path, godot::FileAccess::WRITE);
+
+		if (file.is_null() || file->get_error() != godot::Error::OK)
+		{
+			DEBUG_PRINT_ERROR(godot::vformat("Failed to open the file %s", temp_path));
+			return;
+		}
+
+		file->store_string(text);
+
+		file->close();
+
+		if (godot::DirAccess::rename_absolute(temp_path, path) != godot::Error::OK)
+		{
+			DEBUG_PRINT_ERROR(godot::vformat("Failed to replace the file %s", path));
+		}
+	}
+
 	void LoadJsonConfig(Config& config)
 	{
 		if (config.path.is_empty())
@@ -46,6 +168,40 @@ namespace voxel_game::simulation
 		file->store_string(godot::JSON::stringify(config.values, "    "));
 
 		file->close();
+
+		config.dirty = false;
+	}
+
+	void InitializeConfigWriter()
+	{
+		DEBUG_ASSERT(!config_writer, "The config writer is already initialized");
+
+		config_writer = std::make_unique<ConfigWriter>();
+	}
+
+	void UninitializeConfigWriter()
+	{
+		// Joins the thread after it wrote everything still queued
+		config_writer.reset();
+	}
+
+	ConfigWriter& GetConfigWriter()
+	{
+		DEBUG_ASSERT(config_writer, "The config writer should be initialized with the library");
+
+		return *config_writer;
+	}
+
+	void QueueSaveJsonConfig(Config& config)
+	{
+		if (config.path.is_empty())
+		{
+			return;
+		}
+
+		GetConfigWriter().Queue(config.path, godot::JSON::stringify(config.values, "    "));
+
+		config.dirty = false;
 	}
 
 	void InitializeConfig(Config& config, const godot::String& path, const ConfigDefaults& defaults)
@@ -59,9 +215,8 @@ namespace voxel_game::simulation
 			if (!config.values.has(key))
 			{
 				config.values[key] = value;
+				config.dirty = true;
 			}
 		}
-
-		simulation::SaveJsonConfig(config);
 	}
 }
\ No newline at end of file
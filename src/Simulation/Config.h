@@ -1,24 +1,74 @@
 #pragma once
 
 #include "Util/GodotHash.h"
+#include "Util/Nocopy.h"
 
 #include <godot_cpp/variant/string.hpp>
 #include <godot_cpp/variant/dictionary.hpp>
 #include <godot_cpp/variant/variant.hpp>
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 namespace voxel_game::simulation
 {
 	struct Config
 	{
 		godot::String path;
 		godot::Dictionary values;
+
+		// Set when the values changed since they were last saved
+		bool dirty = false;
 	};
 
 	using ConfigDefaults = robin_hood::unordered_map<godot::String, godot::Variant>;
 
+	// Writes files on a background thread so that saving doesn't stall the simulation. Files are written to a temporary
+	// file first and renamed over the old one so a crash never leaves half a file. Writes to the same path that are
+	// queued close together are merged into the last one
+	class ConfigWriter : Nocopy, Nomove
+	{
+	public:
+		ConfigWriter();
+		~ConfigWriter();
+
+		void Queue(const godot::String& path, const godot::String& text);
+
+		// Block until everything queued so far has been written
+		void Flush();
+
+	private:
+		void ThreadLoop();
+
+		void Write(const godot::String& path, const godot::String& text);
+
+	private:
+		std::thread m_thread;
+
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+
+		std::vector<std::pair<godot::String, godot::String>> m_pending;
+		bool m_writing = false;
+		bool m_flush_requested = false;
+		bool m_running = true;
+	};
+
 	void LoadJsonConfig(Config& config);
 
 	void SaveJsonConfig(Config& config);
 
+	// The writer is shared by every simulation in the process so they don't each start a thread. It is created and
+	// destroyed with the library so its thread never outlives the godot binding
+	void InitializeConfigWriter();
+	void UninitializeConfigWriter();
+
+	ConfigWriter& GetConfigWriter();
+
+	// Serialize the config now and write it on the shared writers thread
+	void QueueSaveJsonConfig(Config& config);
+
 	void InitializeConfig(Config& config, const godot::String& path, const ConfigDefaults& defaults);
 }
\ No newline at end of file
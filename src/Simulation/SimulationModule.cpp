@@ -5,16 +5,57 @@
 #include "UniverseSimulation.h"
 
 #include <godot_cpp/classes/os.hpp>
+#include <godot_cpp/classes/project_settings.hpp>
 
 namespace voxel_game::simulation
 {
 	thread_local ThreadContext* thread_context = nullptr;
 
+	// The simulation instance and context epoch the threads context was bound for. Instances are keyed by id because a
+	// new simulation can be allocated where a freed one was
+	thread_local uint64_t bound_instance_id = 0;
+	thread_local uint64_t bound_epoch = 0;
+
+	// Zero is never handed out so that it can mean no simulation
+	std::atomic_uint64_t next_instance_id = 1;
+
 	void SetContext(ThreadContext& context)
 	{
 		thread_context = &context;
 	}
 
+	void BindContext(Simulation& simulation)
+	{
+		if (bound_instance_id == simulation.instance_id && bound_epoch == simulation.context_epoch)
+		{
+			return;
+		}
+
+		uint32_t index = simulation.bound_context_count.fetch_add(1, std::memory_order_relaxed);
+
+		// Indexing past the end would corrupt memory so this fails in every build
+		CRASH_COND_MSG(index >= simulation.thread_contexts.size(), "More threads are running tasks than there are thread contexts");
+
+		thread_context = &simulation.thread_contexts[index];
+		bound_instance_id = simulation.instance_id;
+		bound_epoch = simulation.context_epoch;
+	}
+
+	void BeginFrameContexts(Simulation& simulation)
+	{
+		for (ThreadContext& context : simulation.thread_contexts)
+		{
+			context.arena.Reset();
+		}
+
+		simulation.context_epoch++;
+		simulation.bound_context_count.store(1, std::memory_order_relaxed);
+
+		thread_context = &simulation.thread_contexts[0];
+		bound_instance_id = simulation.instance_id;
+		bound_epoch = simulation.context_epoch;
+	}
+
 	ThreadContext& GetContext()
 	{
 		DEBUG_ASSERT(thread_context != nullptr, "This thread doesn't have a context yet");
@@ -38,10 +79,44 @@ namespace voxel_game::simulation
 
 	void Initialize(Simulation& simulation)
 	{
-		simulation.processor_count = godot::OS::get_singleton()->get_processor_count();
-		simulation.worker_count = simulation.processor_count;
+		simulation.instance_id = next_instance_id.fetch_add(1, std::memory_order_relaxed);
 
-		simulation.thread_contexts.resize(simulation.worker_count);
+		if (simulation.job_system)
+		{
+			size_t width = simulation.job_system->GetWorkerCount();
+
+			if (simulation.worker_share > 0)
+			{
+				width = std::min<size_t>(width, simulation.worker_share);
+			}
+
+			simulation.job_share = std::make_unique<JobShare>(*simulation.job_system, width);
+
+			// The simulation thread helps run tasks while waiting on them
+			simulation.processor_count = simulation.job_share->GetWidth() + 1;
+			simulation.task_backend = &job_system_task_backend;
+
+			// One context for each slot of the share. Slot 0 is the simulation thread
+			simulation.thread_contexts.resize(simulation.processor_count);
+		}
+		else
+		{
+			// The worker share doesn't apply here as concurrent group tasks can run on any of the pools threads. Contexts
+			// are sized by the pools real thread count so that every thread that runs a task gets one
+			int64_t pool_threads = godot::ProjectSettings::get_singleton()->get_setting("threading/worker_pool/max_threads", -1);
+
+			if (pool_threads <= 0)
+			{
+				pool_threads = godot::OS::get_singleton()->get_processor_count();
+			}
+
+			simulation.processor_count = std::min<int64_t>(pool_threads, UINT8_MAX - 1);
+
+			// One context for the simulation thread and one for each thread that can run tasks
+			simulation.thread_contexts.resize(simulation.processor_count + 1);
+		}
+
+		simulation.worker_count = simulation.processor_count;
 
 		SetContext(simulation.thread_contexts[0]);
 
@@ -52,6 +127,14 @@ namespace voxel_game::simulation
 
 	void Uninitialize(Simulation& simulation)
 	{
+		simulation.job_share.reset();
+
+		if (simulation.config.dirty)
+		{
+			simulation::QueueSaveJsonConfig(simulation.config);
+		}
+
+		simulation::GetConfigWriter().Flush();
 	}
 
 	bool IsUnloadDone(Simulation& simulation)
@@ -64,10 +147,10 @@ namespace voxel_game::simulation
 		simulation.frame_index++;
 		simulation.frame_start_time = Clock::now();
 
-		if (simulation.frame_start_time - simulation.last_config_save > 10s)
+		// Only changed configs are saved and the writing happens off the simulation thread
+		if (simulation.config.dirty)
 		{
-			simulation::SaveJsonConfig(simulation.config);
-			simulation.last_config_save = simulation.frame_start_time;
+			simulation::QueueSaveJsonConfig(simulation.config);
 		}
 	}
 
@@ -13,6 +13,12 @@ namespace voxel_game::simulation
 	void SetContext(ThreadContext& context);
 	ThreadContext& GetContext();
 
+	// Give the calling thread its own context for the current frame if it doesn't have one yet
+	void BindContext(Simulation& simulation);
+
+	// Reset the per frame state of all contexts and give the calling thread the first one
+	void BeginFrameContexts(Simulation& simulation);
+
 	// Module functions
 	void Initialize(Simulation& simulation);
 	void Uninitialize(Simulation& simulation);
@@ -10,13 +10,73 @@
 
 #include <easy/profiler.h>
 
-#define BIND_METHOD godot::ClassDB::bind_method
+#define BIND_METHOD(definition, method) BindCommand<method>(definition)
 
 namespace voxel_game
 {
-	const size_t k_ticks_per_second = 20;
+	const uint32_t k_default_ticks_per_second = 20;
 
-	SimulationServer::SimulationServer()
+	// How many missed ticks are run back to back before the rest are dropped
+	const size_t k_max_catch_up_ticks = 5;
+
+	// Command recordings start with these so that other files aren't replayed by mistake
+	const uint32_t k_recording_magic = 0x52434756; // "VGCR"
+	const uint32_t k_recording_version = 1;
+
+	bool TickPacer::Begin(uint32_t ticks_per_second, Clock::time_point& wait_until)
+	{
+		m_now = Clock::now();
+		m_ticks = 0;
+
+		if (ticks_per_second == 0)
+		{
+			m_next_tick = m_now;
+			m_tick_duration = Clock::duration::zero();
+			return true;
+		}
+
+		if (m_now < m_next_tick)
+		{
+			wait_until = m_next_tick;
+			return false;
+		}
+
+		m_tick_duration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / ticks_per_second));
+
+		return true;
+	}
+
+	bool TickPacer::Next()
+	{
+		m_next_tick += m_tick_duration;
+		m_ticks++;
+
+		m_now = Clock::now();
+
+		return m_tick_duration != Clock::duration::zero() && m_now >= m_next_tick && m_ticks < k_max_catch_up_ticks;
+	}
+
+	uint64_t TickPacer::DropMissedTicks()
+	{
+		if (m_tick_duration == Clock::duration::zero() || m_now < m_next_tick)
+		{
+			return 0;
+		}
+
+		uint64_t dropped_ticks = (m_now - m_next_tick) / m_tick_duration + 1;
+
+		m_next_tick += dropped_ticks * m_tick_duration;
+
+		return dropped_ticks;
+	}
+
+	bool TickPacer::IsCatchingUp() const
+	{
+		return m_ticks > 0;
+	}
+
+	SimulationServer::SimulationServer() :
+		m_ticks_per_second(k_default_ticks_per_second)
 	{}
 
 	SimulationServer::~SimulationServer()
@@ -67,8 +127,17 @@ namespace voxel_game
 		{
 			DoSimulationUnload();
 
+			StopRecording();
+			StopReplay();
+
+			m_tick = 0;
+
 			m_state.store(State::Unloaded);
 		}
+		else
+		{
+			WakeThread();
+		}
 	}
 
 	void SimulationServer::WaitUntilStopped()
@@ -86,7 +155,18 @@ namespace voxel_game
 	{
 		if (m_state.load(std::memory_order_acquire) == State::Loaded) // Don't progress until loaded
 		{
+			// When not threaded the simulation ticks here so replayed commands have to be run first
+			if (!IsThreaded())
+			{
+				ProcessReplayCommands();
+			}
+
 			DoSimulationProgress(delta);
+
+			if (!IsThreaded())
+			{
+				m_tick++;
+			}
 		}
 	}
 
@@ -100,31 +180,256 @@ namespace voxel_game
 
 		m_state.store(State::Loaded, std::memory_order_release);
 
+		TickPacer pacer;
+
 		while (m_state.load(std::memory_order_acquire) == State::Loaded)
 		{
-			TCommandBuffer<SimulationServer> command_buffer;
+			ProcessDeferredCommands();
+
+			Clock::time_point wait_until;
+
+			if (!pacer.Begin(m_ticks_per_second.load(std::memory_order_relaxed), wait_until))
 			{
-				std::lock_guard lock(m_commands_mutex);
-				command_buffer = std::move(m_deferred_commands);
+				// Sleep until the next tick or until a command arrives so it can be processed right away
+				std::unique_lock lock(m_wake_mutex);
+				m_wake_condition.wait_until(lock, wait_until, [this]() { return m_wake_requested; });
+				m_wake_requested = false;
+				continue;
 			}
 
-			// Process the deferred commands sent by other threads
-			command_buffer.ProcessCommands(*this);
+			// Run the tick that is due and catch up on missed ones if we fell behind
+			do
+			{
+				if (pacer.IsCatchingUp())
+				{
+					ProcessDeferredCommands();
+				}
+
+				DoSimulationThreadProgress();
+
+				m_tick++;
 
-			DoSimulationThreadProgress();
+				FlushSignals();
+			}
+			while (pacer.Next());
 
-			if (m_deferred_signals.NumCommands() > 0)
+			if (uint64_t dropped_ticks = pacer.DropMissedTicks())
 			{
-				// Flush signals to be executed on main thread
-				CommandServer::get_singleton()->AddCommands(get_instance_id(), std::move(m_deferred_signals));
+				m_overload_count.fetch_add(1, std::memory_order_relaxed);
+
+				QueueSignal("tick_overloaded", dropped_ticks);
+
+				FlushSignals();
 			}
 		}
 
 		DoSimulationUnload();
 
+		StopRecording();
+		StopReplay();
+
+		FlushSignals();
+
+		m_tick = 0;
+
 		m_state.store(State::Unloaded);
 	}
 
+	void SimulationServer::ProcessDeferredCommands()
+	{
+		ProcessReplayCommands();
+
+		TCommandBuffer<SimulationServer> command_buffer;
+		std::vector<RecordedCommand> recorded_commands;
+		{
+			std::lock_guard lock(m_commands_mutex);
+			command_buffer = std::move(m_deferred_commands);
+			recorded_commands = std::move(m_recorded_commands);
+			m_recorded_commands.clear();
+		}
+
+		// Write the commands before running them in case one of them stops the recording
+		if (m_recording_file.is_valid())
+		{
+			for (const RecordedCommand& command : recorded_commands)
+			{
+				m_recording_file->store_64(m_tick - m_recording_start_tick);
+				m_recording_file->store_pascal_string(godot::String::utf8(command.name.c_str()));
+				m_recording_file->store_var(command.arguments);
+			}
+		}
+
+		// Process the deferred commands sent by other threads
+		command_buffer.ProcessCommands(*this);
+	}
+
+	void SimulationServer::ProcessReplayCommands()
+	{
+		if (!m_replaying.load(std::memory_order_relaxed))
+		{
+			return;
+		}
+
+		// The commands are called by name on the simulation thread so they run right away instead of being deferred again
+		while (m_replay_index < m_replay_commands.size() && m_replay_commands[m_replay_index].tick <= m_tick - m_replay_start_tick)
+		{
+			// Copied out as a replayed start_replay or stop_replay replaces the commands
+			RecordedCommand command = m_replay_commands[m_replay_index];
+
+			m_replay_index++;
+
+			callv(godot::StringName(command.name.c_str()), command.arguments);
+
+			if (!m_replaying.load(std::memory_order_relaxed))
+			{
+				return;
+			}
+		}
+
+		if (m_replay_index == m_replay_commands.size())
+		{
+			StopReplay();
+
+			QueueSignal("replay_finished");
+		}
+	}
+
+	void SimulationServer::FlushSignals()
+	{
+		if (m_deferred_signals.NumCommands() > 0)
+		{
+			// Flush signals to be executed on main thread
+			CommandServer::get_singleton()->AddCommands(get_instance_id(), std::move(m_deferred_signals));
+		}
+	}
+
+	void SimulationServer::WakeThread()
+	{
+		{
+			std::lock_guard lock(m_wake_mutex);
+			m_wake_requested = true;
+		}
+
+		m_wake_condition.notify_one();
+	}
+
+	void SimulationServer::SetTickRate(uint32_t ticks_per_second)
+	{
+		m_ticks_per_second.store(ticks_per_second, std::memory_order_relaxed);
+
+		WakeThread();
+	}
+
+	uint32_t SimulationServer::GetTickRate()
+	{
+		return m_ticks_per_second.load(std::memory_order_relaxed);
+	}
+
+	uint64_t SimulationServer::GetOverloadCount()
+	{
+		return m_overload_count.load(std::memory_order_relaxed);
+	}
+
+	void SimulationServer::StartRecording(const godot::String& path)
+	{
+		if (DeferCommand<&SimulationServer::StartRecording>(path))
+		{
+			return;
+		}
+
+		StopRecording();
+
+		m_recording_file = godot::FileAccess::open(path, godot::FileAccess::WRITE);
+
+		if (m_recording_file.is_null() || m_recording_file->get_error() != godot::Error::OK)
+		{
+			DEBUG_PRINT_ERROR(godot::vformat("Failed to open the file %s", path));
+			m_recording_file.unref();
+			return;
+		}
+
+		m_recording_file->store_32(k_recording_magic);
+		m_recording_file->store_32(k_recording_version);
+
+		m_recording_start_tick = m_tick;
+
+		m_recording.store(true, std::memory_order_relaxed);
+	}
+
+	void SimulationServer::StopRecording()
+	{
+		if (DeferCommand<&SimulationServer::StopRecording>())
+		{
+			return;
+		}
+
+		m_recording.store(false, std::memory_order_relaxed);
+
+		if (m_recording_file.is_valid())
+		{
+			m_recording_file->close();
+			m_recording_file.unref();
+		}
+	}
+
+	void SimulationServer::StartReplay(const godot::String& path)
+	{
+		if (DeferCommand<&SimulationServer::StartReplay>(path))
+		{
+			return;
+		}
+
+		StopReplay();
+
+		godot::Ref<godot::FileAccess> file = godot::FileAccess::open(path, godot::FileAccess::READ);
+
+		if (file.is_null() || file->get_error() != godot::Error::OK)
+		{
+			DEBUG_PRINT_ERROR(godot::vformat("Failed to open the file %s", path));
+			return;
+		}
+
+		if (file->get_32() != k_recording_magic || file->get_32() != k_recording_version)
+		{
+			DEBUG_PRINT_ERROR(godot::vformat("The file %s is not a command recording this version can replay", path));
+			return;
+		}
+
+		while (file->get_position() < file->get_length())
+		{
+			RecordedCommand& command = m_replay_commands.emplace_back();
+
+			command.tick = file->get_64();
+			command.name = file->get_pascal_string().utf8().get_data();
+			command.arguments = file->get_var();
+		}
+
+		file->close();
+
+		m_replay_index = 0;
+		m_replay_start_tick = m_tick;
+
+		m_replaying.store(true, std::memory_order_relaxed);
+	}
+
+	void SimulationServer::StopReplay()
+	{
+		if (DeferCommand<&SimulationServer::StopReplay>())
+		{
+			return;
+		}
+
+		m_replaying.store(false, std::memory_order_relaxed);
+
+		m_replay_commands.clear();
+		m_replay_index = 0;
+	}
+
+	bool SimulationServer::IsReplaying()
+	{
+		return m_replaying.load(std::memory_order_relaxed);
+	}
+
 	void SimulationServer::_bind_methods()
 	{
 		BIND_ENUM_CONSTANT(THREAD_MODE_SINGLE_THREADED);
@@ -135,7 +440,17 @@ namespace voxel_game
 		BIND_METHOD(godot::D_METHOD("wait_until_stopped"), &SimulationServer::WaitUntilStopped);
 		BIND_METHOD(godot::D_METHOD("is_threaded"), &SimulationServer::IsThreaded);
 		BIND_METHOD(godot::D_METHOD("progress", "delta"), &SimulationServer::Progress);
+		BIND_METHOD(godot::D_METHOD("set_tick_rate", "ticks_per_second"), &SimulationServer::SetTickRate);
+		BIND_METHOD(godot::D_METHOD("get_tick_rate"), &SimulationServer::GetTickRate);
+		BIND_METHOD(godot::D_METHOD("get_overload_count"), &SimulationServer::GetOverloadCount);
+		BIND_METHOD(godot::D_METHOD("start_recording", "path"), &SimulationServer::StartRecording);
+		BIND_METHOD(godot::D_METHOD("stop_recording"), &SimulationServer::StopRecording);
+		BIND_METHOD(godot::D_METHOD("start_replay", "path"), &SimulationServer::StartReplay);
+		BIND_METHOD(godot::D_METHOD("stop_replay"), &SimulationServer::StopReplay);
+		BIND_METHOD(godot::D_METHOD("is_replaying"), &SimulationServer::IsReplaying);
 
 		ADD_SIGNAL(godot::MethodInfo("load_state_changed", ENUM_PROPERTY("state", SimulationServer::LoadState)));
+		ADD_SIGNAL(godot::MethodInfo("tick_overloaded", godot::PropertyInfo(godot::Variant::INT, "dropped_ticks")));
+		ADD_SIGNAL(godot::MethodInfo("replay_finished"));
 	}
 }
\ No newline at end of file
@@ -4,20 +4,57 @@
 
 #include "Util/Debug.h"
 #include "Util/PerThread.h"
+#include "Util/Util.h"
 
 #include <godot_cpp/classes/ref_counted.hpp>
 #include <godot_cpp/classes/object.hpp>
+#include <godot_cpp/classes/file_access.hpp>
 #include <godot_cpp/classes/global_constants_binds.hpp>
 
+#include <godot_cpp/variant/array.hpp>
+
+#include <godot_cpp/core/class_db.hpp>
 #include <godot_cpp/core/gdvirtual.gen.inc>
 
 #include <TKRZW/tkrzw_thread_util.h>
 
+#include <condition_variable>
+#include <mutex>
 #include <optional>
+#include <string>
 #include <thread>
+#include <vector>
 
 namespace voxel_game
 {
+	// The bound name of a method that can be deferred. Set when binding the method with BindCommand
+	template<auto Method>
+	inline std::string k_command_name;
+
+	// Paces a loop to a tick rate. A loop that falls behind runs a few missed ticks back to back and drops the rest
+	// instead of spiraling further behind. A rate of zero ticks as fast as possible
+	class TickPacer
+	{
+	public:
+		// Check if a tick is due at the rate. If not, then wait_until is set to when the next one is
+		bool Begin(uint32_t ticks_per_second, Clock::time_point& wait_until);
+
+		// Call after every tick. Returns true if another missed tick should run right away
+		bool Next();
+
+		// Call once Next() returns false. Returns how many ticks were dropped, zero unless we fell too far behind
+		uint64_t DropMissedTicks();
+
+		// If the tick about to run is catching up on a missed one
+		bool IsCatchingUp() const;
+
+	private:
+		Clock::time_point m_next_tick = Clock::now();
+		Clock::time_point m_now;
+		Clock::duration m_tick_duration = Clock::duration::zero();
+		size_t m_ticks = 0;
+	};
+
 	// A simulation object that runs a simulation for which commands are given as an input and
 	// signals are given as an output. When running in threaded mode, the commands and signals
 	// are efficiently buffered and sent between threads with minimal blocking
@@ -61,6 +98,22 @@ namespace voxel_game
 		// Progress the simulation from the owning thread. When in thread mode, this is just to communicate with the thread
 		void Progress(real_t delta);
 
+		// How many times a second the simulation thread ticks. Zero ticks as fast as possible
+		void SetTickRate(uint32_t ticks_per_second);
+		uint32_t GetTickRate();
+
+		// How many times the simulation thread fell too far behind and had to drop ticks
+		uint64_t GetOverloadCount();
+
+		// Write every deferred command with the tick it ran on to a file. Only commands deferred in threaded mode are recorded
+		void StartRecording(const godot::String& path);
+		void StopRecording();
+
+		// Run the commands of a recording at the same ticks they were recorded on, counted from when the replay starts
+		void StartReplay(const godot::String& path);
+		void StopReplay();
+		bool IsReplaying();
+
 	protected:
 		// If the following methods are overridden then the script overrides will no longer work.
 
@@ -87,9 +140,31 @@ namespace voxel_game
 		template<auto Method, class... Args>
 		bool DeferCommand(Args&&... p_args);
 
+		// Bind a method and remember its name so that deferred calls to it can be recorded and replayed
+		template<auto Method>
+		static void BindCommand(const godot::MethodDefinition& definition);
+
 	private:
+		struct RecordedCommand
+		{
+			uint64_t tick;
+			std::string name;
+			godot::Array arguments;
+		};
+
+		template<class T>
+		static godot::Variant CommandArgumentToVariant(const T& argument);
+
 		void ThreadLoop();
 
+		// Run the commands that are due this tick. Call on the simulation thread
+		void ProcessDeferredCommands();
+		void ProcessReplayCommands();
+		void FlushSignals();
+
+		// Wake the simulation thread early if it is sleeping until the next tick
+		void WakeThread();
+
 	public:
 		static void _bind_methods();
 
@@ -106,6 +181,28 @@ namespace voxel_game
 
 		// Signals sent by the internal thread and deferred to be run by the main thread
 		alignas(k_cache_line) TCommandBuffer<SimulationServer> m_deferred_signals;
+
+		std::atomic_uint32_t m_ticks_per_second;
+		std::atomic_uint64_t m_overload_count = 0;
+
+		// How many ticks have run since the simulation started. Only used by the simulation thread
+		uint64_t m_tick = 0;
+
+		// Recorded commands are collected with the deferred commands and written by the simulation thread
+		std::atomic_bool m_recording = false;
+		std::vector<RecordedCommand> m_recorded_commands;
+		godot::Ref<godot::FileAccess> m_recording_file;
+		uint64_t m_recording_start_tick = 0;
+
+		std::atomic_bool m_replaying = false;
+		std::vector<RecordedCommand> m_replay_commands;
+		size_t m_replay_index = 0;
+		uint64_t m_replay_start_tick = 0;
+
+		// Lets the internal thread sleep between ticks while still being woken for new commands
+		std::mutex m_wake_mutex;
+		std::condition_variable m_wake_condition;
+		bool m_wake_requested = false;
 	};
 
 	template<class... Args>
@@ -128,8 +225,23 @@ namespace voxel_game
 	{
 		if (IsThreaded() && std::this_thread::get_id() != m_thread.get_id())
 		{
-			std::lock_guard lock(m_commands_mutex);
-			m_deferred_commands.AddCommand<Method>(std::forward<Args>(args)...);
+			{
+				std::lock_guard lock(m_commands_mutex);
+
+				if (m_recording.load(std::memory_order_relaxed))
+				{
+					DEBUG_ASSERT(!k_command_name<Method>.empty(), "Deferred methods should be bound with BindCommand to be recorded");
+
+					godot::Array arguments;
+					(arguments.push_back(CommandArgumentToVariant(args)), ...);
+
+					m_recorded_commands.push_back({ 0, k_command_name<Method>, arguments });
+				}
+
+				m_deferred_commands.AddCommand<Method>(std::forward<Args>(args)...);
+			}
+
+			WakeThread();
 			return true;
 		}
 		else
@@ -137,6 +249,27 @@ namespace voxel_game
 			return false;
 		}
 	}
+
+	template<auto Method>
+	void SimulationServer::BindCommand(const godot::MethodDefinition& definition)
+	{
+		k_command_name<Method> = godot::String(definition.name).utf8().get_data();
+
+		godot::ClassDB::bind_method(definition, Method);
+	}
+
+	template<class T>
+	godot::Variant SimulationServer::CommandArgumentToVariant(const T& argument)
+	{
+		if constexpr (std::is_enum_v<T>)
+		{
+			return int64_t(argument);
+		}
+		else
+		{
+			return argument;
+		}
+	}
 }
 
 VARIANT_ENUM_CAST(voxel_game::SimulationServer::ThreadMode);
\ No newline at end of file
@@ -0,0 +1,210 @@
+#include "Timing.h"
+
+#include "UniverseSimulation.h"
+
+#include <godot_cpp/classes/json.hpp>
+#include <godot_cpp/variant/array.hpp>
+
+#include <robin_hood/robin_hood.h>
+
+#include <algorithm>
+#include <string_view>
+
+namespace voxel_game::simulation
+{
+	const char* const k_task_timing_name = "Task";
+	const char* const k_frame_timing_name = "Frame";
+
+	void TimingRing::Push(const TimingSpan& span)
+	{
+		uint64_t head = m_head.load(std::memory_order_relaxed);
+
+		m_spans[head % k_capacity] = span;
+
+		m_head.store(head + 1, std::memory_order_release);
+	}
+
+	void TimingRing::ReadLatest(std::vector<TimingSpan>& spans_out) const
+	{
+		uint64_t head = m_head.load(std::memory_order_acquire);
+		uint64_t first = head > k_capacity ? head - k_capacity : 0;
+
+		size_t start = spans_out.size();
+
+		for (uint64_t index = first; index < head; index++)
+		{
+			spans_out.push_back(m_spans[index % k_capacity]);
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		// The writer may have overwritten the oldest spans while we were copying, including the one it is writing now
+		uint64_t new_head = m_head.load(std::memory_order_relaxed);
+		uint64_t valid_first = new_head >= k_capacity ? new_head - k_capacity + 1 : 0;
+
+		if (valid_first > first)
+		{
+			size_t overwritten = std::min(valid_first - first, head - first);
+
+			spans_out.erase(spans_out.begin() + start, spans_out.begin() + start + overwritten);
+		}
+	}
+
+	int64_t GetTimingNow()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+	}
+
+	ScopedTiming::ScopedTiming(TimingRing& ring, const char* name, uint64_t frame) :
+		m_ring(ring),
+		m_span{ name, frame, GetTimingNow(), 0 }
+	{}
+
+	ScopedTiming::~ScopedTiming()
+	{
+		m_span.end = GetTimingNow();
+
+		m_ring.Push(m_span);
+	}
+
+	godot::Dictionary GetPercentiles(std::vector<int64_t>& durations)
+	{
+		godot::Dictionary stats;
+
+		stats["count"] = int64_t(durations.size());
+
+		if (durations.empty())
+		{
+			return stats;
+		}
+
+		std::sort(durations.begin(), durations.end());
+
+		auto percentile = [&durations](double fraction)
+		{
+			size_t index = std::min(size_t(fraction * durations.size()), durations.size() - 1);
+
+			return durations[index] / 1e6;
+		};
+
+		stats["p50"] = percentile(0.5);
+		stats["p95"] = percentile(0.95);
+		stats["p99"] = percentile(0.99);
+		stats["max"] = durations.back() / 1e6;
+
+		return stats;
+	}
+
+	godot::Dictionary GetTimingStats(const Simulation& simulation)
+	{
+		robin_hood::unordered_map<std::string_view, std::vector<int64_t>> name_durations;
+		robin_hood::unordered_map<uint64_t, int64_t> frame_durations;
+
+		std::vector<std::vector<TimingSpan>> context_spans(simulation.thread_contexts.size());
+
+		for (size_t index = 0; index < simulation.thread_contexts.size(); index++)
+		{
+			simulation.thread_contexts[index].timings->ReadLatest(context_spans[index]);
+
+			for (const TimingSpan& span : context_spans[index])
+			{
+				name_durations[span.name].push_back(span.end - span.begin);
+
+				if (span.name == k_frame_timing_name)
+				{
+					frame_durations[span.frame] = span.end - span.begin;
+				}
+			}
+		}
+
+		godot::Dictionary stats;
+
+		for (auto&& [name, durations] : name_durations)
+		{
+			stats[godot::String::utf8(name.data(), name.size())] = GetPercentiles(durations);
+		}
+
+		// Busy time is the time spent in tasks during a frame and idle time is the rest of the frame
+		godot::Array contexts;
+
+		for (const std::vector<TimingSpan>& spans : context_spans)
+		{
+			robin_hood::unordered_map<uint64_t, int64_t> frame_busy;
+
+			for (const TimingSpan& span : spans)
+			{
+				if (span.name == k_task_timing_name)
+				{
+					frame_busy[span.frame] += span.end - span.begin;
+				}
+			}
+
+			std::vector<int64_t> busy;
+			std::vector<int64_t> idle;
+
+			for (auto&& [frame, duration] : frame_durations)
+			{
+				auto it = frame_busy.find(frame);
+				int64_t frame_busy_time = it != frame_busy.end() ? it->second : 0;
+
+				busy.push_back(frame_busy_time);
+				idle.push_back(std::max<int64_t>(duration - frame_busy_time, 0));
+			}
+
+			godot::Dictionary context_stats;
+			context_stats["busy"] = GetPercentiles(busy);
+			context_stats["idle"] = GetPercentiles(idle);
+
+			contexts.push_back(context_stats);
+		}
+
+		stats["thread_contexts"] = contexts;
+
+		return stats;
+	}
+
+	godot::String GetChromeTrace(const Simulation& simulation)
+	{
+		std::vector<std::vector<TimingSpan>> context_spans(simulation.thread_contexts.size());
+
+		int64_t start = INT64_MAX;
+
+		for (size_t index = 0; index < simulation.thread_contexts.size(); index++)
+		{
+			simulation.thread_contexts[index].timings->ReadLatest(context_spans[index]);
+
+			for (const TimingSpan& span : context_spans[index])
+			{
+				start = std::min(start, span.begin);
+			}
+		}
+
+		// Complete events with times in microseconds and one trace thread for each thread context
+		godot::Array events;
+
+		for (size_t index = 0; index < context_spans.size(); index++)
+		{
+			for (const TimingSpan& span : context_spans[index])
+			{
+				godot::Dictionary event;
+				event["name"] = godot::String(span.name);
+				event["ph"] = "X";
+				event["ts"] = (span.begin - start) / 1e3;
+				event["dur"] = (span.end - span.begin) / 1e3;
+				event["pid"] = 0;
+				event["tid"] = int64_t(index);
+
+				godot::Dictionary args;
+				args["frame"] = int64_t(span.frame);
+				event["args"] = args;
+
+				events.push_back(event);
+			}
+		}
+
+		godot::Dictionary trace;
+		trace["traceEvents"] = events;
+
+		return godot::JSON::stringify(trace);
+	}
+}
\ No newline at end of file
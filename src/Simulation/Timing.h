@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Util/Util.h"
+#include "Util/Nocopy.h"
+
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/string.hpp>
+
+#include <array>
+#include <atomic>
+#include <vector>
+
+namespace voxel_game
+{
+	struct Simulation;
+}
+
+namespace voxel_game::simulation
+{
+	// Spans with this name are time a thread spent running tasks and count as busy time
+	extern const char* const k_task_timing_name;
+
+	// Spans with this name cover a whole simulation update
+	extern const char* const k_frame_timing_name;
+
+	// Time spent on something during a frame. Times are nanoseconds of the steady clock
+	struct TimingSpan
+	{
+		const char* name;
+		uint64_t frame;
+		int64_t begin;
+		int64_t end;
+	};
+
+	// A ring buffer of the latest spans. One thread writes at a time while any thread can read without locking.
+	// Readers drop spans that were overwritten while they were being copied
+	class TimingRing : Nocopy, Nomove
+	{
+	public:
+		constexpr static size_t k_capacity = 4096;
+
+		void Push(const TimingSpan& span);
+
+		// Copy the latest spans that are still intact, oldest first
+		void ReadLatest(std::vector<TimingSpan>& spans_out) const;
+
+	private:
+		std::array<TimingSpan, k_capacity> m_spans;
+		std::atomic_uint64_t m_head = 0;
+	};
+
+	int64_t GetTimingNow();
+
+	// Records a span from construction to destruction
+	class ScopedTiming : Nocopy, Nomove
+	{
+	public:
+		ScopedTiming(TimingRing& ring, const char* name, uint64_t frame);
+		~ScopedTiming();
+
+	private:
+		TimingRing& m_ring;
+		TimingSpan m_span;
+	};
+
+	// The count, p50, p95, p99 and max in milliseconds of durations in nanoseconds. Sorts the durations
+	godot::Dictionary GetPercentiles(std::vector<int64_t>& durations);
+
+	// Rolling p50/p95/p99 of every span name over what the rings still hold, plus busy and idle time for each thread context
+	godot::Dictionary GetTimingStats(const Simulation& simulation);
+
+	// The spans the rings still hold in the chrome trace event format
+	godot::String GetChromeTrace(const Simulation& simulation);
+}
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include "Components.h"
 #include "UniverseSimulation.h"
 
+#include "Simulation/SimulationModule.h"
+
 #include "Util/Debug.h"
 #include "Util/Callback.h"
 
@@ -50,6 +52,8 @@ namespace voxel_game::spatial3d
 
 		spatial3d::WorldPtr world = spatial3d::CreateWorld(type, path);
 
+		world->*&World::entity = entity;
+
 		entity->*&CWorld::world = world;
 
 		simulation.spatial_worlds.push_back(world);
@@ -64,23 +68,102 @@ namespace voxel_game::spatial3d
 
 	void OnUnloadSpatialEntity(Simulation& simulation, entity::WRef entity)
 	{
-		UnloadWorld(entity->*&CWorld::world);
+		WorldPtr world = entity->*&CWorld::world;
+
+		UnloadWorld(world);
+
+		// The entity may be destroyed before the world finishes unloading
+		world->*&World::entity = entity::WRef();
 
 		entity->*&CWorld::world = nullptr;
 	}
 
+	// Get the world an entity is in and its transform in that world
+	WorldPtr GetEntityParentWorld(entity::WRef entity, godot::Transform3D& transform)
+	{
+		if (!entity)
+		{
+			return nullptr;
+		}
+
+		if (entity.Has<CPosition>())
+		{
+			transform.origin = entity->*&CPosition::position;
+		}
+
+		if (entity.Has<CRotation>())
+		{
+			transform.basis = godot::Basis(entity->*&CRotation::rotation);
+		}
+
+		return entity.Has<CEntity>() ? entity->*&CEntity::parent_world : nullptr;
+	}
+
+	void WorldFrameUpdateTask(Simulation& simulation, size_t index)
+	{
+		WorldPtr world = simulation.world_frame_levels[simulation.world_frame_level][index];
+
+		godot::Transform3D to_parent;
+
+		WorldPtr parent = GetEntityParentWorld(world->*&World::entity, to_parent);
+
+		WorldUpdateFrame(world, parent, to_parent);
+	}
+
+	// Update the cached frame of every world. Worlds are grouped by how deep they are nested and each
+	// group is updated in parallel after the group above it
+	void UpdateWorldFrames(Simulation& simulation)
+	{
+		EASY_FUNCTION();
+
+		for (std::vector<WorldPtr>& level : simulation.world_frame_levels)
+		{
+			level.clear();
+		}
+
+		for (WorldPtr world : simulation.spatial_worlds)
+		{
+			size_t depth = 0;
+
+			godot::Transform3D transform;
+			WorldPtr parent = GetEntityParentWorld(world->*&World::entity, transform);
+
+			while (parent)
+			{
+				depth++;
+				parent = GetEntityParentWorld(parent->*&World::entity, transform);
+			}
+
+			if (depth >= simulation.world_frame_levels.size())
+			{
+				simulation.world_frame_levels.resize(depth + 1);
+			}
+
+			simulation.world_frame_levels[depth].push_back(world);
+		}
+
+		for (size_t level = 0; level < simulation.world_frame_levels.size(); level++)
+		{
+			simulation.world_frame_level = level;
+
+			TaskData frame_task{ simulation, &WorldFrameUpdateTask, simulation.world_frame_levels[level].size() };
+
+			SimulationDoTasks(simulation, frame_task);
+		}
+	}
+
 	void OnLoadLoaderEntity(Simulation& simulation, entity::WRef entity)
 	{
-		std::vector<entity::WRef>& loaders = (entity->*&CEntity::parent_world)->*&PartialWorld::loaders;
+		std::vector<entity::Handle>& loaders = (entity->*&CEntity::parent_world)->*&PartialWorld::loaders;
 
-		loaders.push_back(entity);
+		loaders.push_back(entity.GetHandle());
 	}
 
 	void OnUnloadLoaderEntity(Simulation& simulation, entity::WRef entity)
 	{
-		std::vector<entity::WRef>& loaders = (entity->*&CEntity::parent_world)->*&PartialWorld::loaders;
+		std::vector<entity::Handle>& loaders = (entity->*&CEntity::parent_world)->*&PartialWorld::loaders;
 
-		unordered_erase(loaders, entity::Ref(entity));
+		unordered_erase(loaders, entity.GetHandle());
 	}
 
 	void Initialize(Simulation& simulation)
@@ -131,6 +214,8 @@ namespace voxel_game::spatial3d
 				it++;
 			}
 		}
+
+		UpdateWorldFrames(simulation);
 	}
 
 	void WorkerUpdate(Simulation& simulation, size_t index)
@@ -150,13 +235,13 @@ namespace voxel_game::spatial3d
 
 	void ScaleUpdate(Simulation& simulation, ScalePtr scale)
 	{
-		ScaleUnloadUnutilizedNodes(scale, simulation.frame_start_time);
+		ScaleUnloadUnutilizedNodes(scale, simulation.frame_index, simulation.frame_start_time);
 
 		if (!simulation.unloading)
 		{
-			ScaleLoadNodesAroundLoaders(scale, simulation.frame_start_time);
+			ScaleLoadNodesAroundLoaders(scale, simulation.entity_factory, simulation.frame_index, simulation.frame_start_time);
 
-			ScaleUpdateEntityNodes(scale);
+			ScaleUpdateEntityNodes(scale, simulation::GetContext().arena);
 		}
 	}
 
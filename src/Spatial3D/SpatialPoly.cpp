@@ -11,6 +11,8 @@ using namespace voxel_game;
 const size_t node_first = __LINE__ + 1;
 template<> template<> const size_t spatial3d::NodeType::k_type_index<spatial3d::NodeType::Header>	= __LINE__ - node_first;
 template<> template<> const size_t spatial3d::NodeType::k_type_index<spatial3d::Node>				= __LINE__ - node_first;
+template<> template<> const size_t spatial3d::NodeType::k_type_index<spatial3d::LinkedNode>			= __LINE__ - node_first;
+template<> template<> const size_t spatial3d::NodeType::k_type_index<spatial3d::CompactNode>		= __LINE__ - node_first;
 template<> template<> const size_t spatial3d::NodeType::k_type_index<spatial3d::PartialNode>		= __LINE__ - node_first;
 template<> template<> const size_t spatial3d::NodeType::k_type_index<spatial3d::LocalNode>			= __LINE__ - node_first;
 template<> template<> const size_t spatial3d::NodeType::k_type_index<spatial3d::RemoteNode>			= __LINE__ - node_first;
@@ -19,10 +21,12 @@ template<> template<> const size_t spatial3d::NodeType::k_type_index<galaxy::Nod
 template<> template<> const size_t spatial3d::NodeType::k_type_index<voxel::Node>					= __LINE__ - node_first;
 template<> template<> const size_t spatial3d::NodeType::k_type_index<voxelrender::Node>				= __LINE__ - node_first;
 
-const std::array<PolyTypeInfo, 10> spatial3d::NodeType::k_type_info =
+const std::array<PolyTypeInfo, 12> spatial3d::NodeType::k_type_info =
 {
 	MakeTypeInfo<spatial3d::NodeType::Header>(),
 	MakeTypeInfo<spatial3d::Node>(),
+	MakeTypeInfo<spatial3d::LinkedNode>(),
+	MakeTypeInfo<spatial3d::CompactNode>(),
 	MakeTypeInfo<spatial3d::PartialNode>(),
 	MakeTypeInfo<spatial3d::LocalNode>(),
 	MakeTypeInfo<spatial3d::RemoteNode>(),
@@ -36,16 +40,18 @@ const size_t scale_first = __LINE__ + 1;
 template<> template<> const size_t spatial3d::ScaleType::k_type_index<spatial3d::ScaleType::Header> = __LINE__ - scale_first;
 template<> template<> const size_t spatial3d::ScaleType::k_type_index<spatial3d::Scale>				= __LINE__ - scale_first;
 template<> template<> const size_t spatial3d::ScaleType::k_type_index<spatial3d::PartialScale>		= __LINE__ - scale_first;
+template<> template<> const size_t spatial3d::ScaleType::k_type_index<spatial3d::CompactScale>		= __LINE__ - scale_first;
 template<> template<> const size_t spatial3d::ScaleType::k_type_index<universe::Scale>				= __LINE__ - scale_first;
 template<> template<> const size_t spatial3d::ScaleType::k_type_index<galaxy::Scale>				= __LINE__ - scale_first;
 template<> template<> const size_t spatial3d::ScaleType::k_type_index<voxel::Scale>					= __LINE__ - scale_first;
 template<> template<> const size_t spatial3d::ScaleType::k_type_index<voxelrender::Scale>			= __LINE__ - scale_first;
 
-const std::array<PolyTypeInfo, 8> spatial3d::ScaleType::k_type_info =
+const std::array<PolyTypeInfo, 9> spatial3d::ScaleType::k_type_info =
 {
 	MakeTypeInfo<spatial3d::ScaleType::Header>(),
 	MakeTypeInfo<spatial3d::Scale>(),
 	MakeTypeInfo<spatial3d::PartialScale>(),
+	MakeTypeInfo<spatial3d::CompactScale>(),
 	MakeTypeInfo<universe::Scale>(),
 	MakeTypeInfo<galaxy::Scale>(),
 	MakeTypeInfo<voxel::Scale>(),
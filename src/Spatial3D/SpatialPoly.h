@@ -6,12 +6,12 @@
 
 namespace voxel_game::spatial3d
 {
-	struct NodeType : PolyType<NodeType, 10>
+	struct NodeType : PolyType<NodeType, 12>
 	{
 		using PolyType::PolyType;
 	};
 
-	struct ScaleType : PolyType<ScaleType, 8>
+	struct ScaleType : PolyType<ScaleType, 9>
 	{
 		using PolyType::PolyType;
 	};
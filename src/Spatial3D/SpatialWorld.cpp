@@ -4,6 +4,7 @@
 #include "Components.h"
 
 #include "Util/GodotOperators.h"
+#include "Util/SmallVector.h"
 
 #include <easy/profiler.h>
 
@@ -138,6 +139,129 @@ namespace voxel_game::spatial3d
 		}
 	}
 
+	NodePtr GetNodeParent(WorldPtr world, NodePtr node)
+	{
+		if (node.Has<CompactNode>())
+		{
+			NodeSlot slot = node->*&CompactNode::parent;
+
+			if (slot == k_invalid_node_slot)
+			{
+				return nullptr;
+			}
+
+			return (GetScale(world, node->*&Node::scale_index + 1)->*&CompactScale::node_table)[slot];
+		}
+		else
+		{
+			return node->*&LinkedNode::parent;
+		}
+	}
+
+	NodePtr GetNodeChild(WorldPtr world, NodePtr node, uint8_t child_index)
+	{
+		DEBUG_ASSERT(child_index < 8, "The child index is out of range");
+
+		if (node.Has<CompactNode>())
+		{
+			NodeSlot slot = (node->*&CompactNode::children)[child_index];
+
+			if (slot == k_invalid_node_slot)
+			{
+				return nullptr;
+			}
+
+			return (GetScale(world, node->*&Node::scale_index - 1)->*&CompactScale::node_table)[slot];
+		}
+		else
+		{
+			return (node->*&LinkedNode::children)[child_index];
+		}
+	}
+
+	NodePtr GetNodeNeighbour(WorldPtr world, NodePtr node, uint8_t neighbour_index)
+	{
+		DEBUG_ASSERT(neighbour_index < 6, "The neighbour index is out of range");
+
+		if (node.Has<CompactNode>())
+		{
+			NodeSlot slot = (node->*&CompactNode::neighbours)[neighbour_index];
+
+			if (slot == k_invalid_node_slot)
+			{
+				return nullptr;
+			}
+
+			return (GetScale(world, node->*&Node::scale_index)->*&CompactScale::node_table)[slot];
+		}
+		else
+		{
+			return (node->*&LinkedNode::neighbours)[neighbour_index];
+		}
+	}
+
+	// Get the slot of a node to store as a link or an invalid slot if there is no node
+	NodeSlot GetLinkSlot(NodePtr node)
+	{
+		return node ? node->*&CompactNode::slot : k_invalid_node_slot;
+	}
+
+	void SetNodeParentLink(NodePtr node, NodePtr parent, uint8_t parent_index)
+	{
+		if (node.Has<CompactNode>())
+		{
+			node->*&CompactNode::parent = GetLinkSlot(parent);
+		}
+		else
+		{
+			node->*&LinkedNode::parent = parent;
+		}
+
+		node->*&Node::parent_index = parent ? parent_index : k_node_no_parent;
+	}
+
+	void SetNodeChildLink(NodePtr node, uint8_t child_index, NodePtr child)
+	{
+		if (node.Has<CompactNode>())
+		{
+			(node->*&CompactNode::children)[child_index] = GetLinkSlot(child);
+		}
+		else
+		{
+			(node->*&LinkedNode::children)[child_index] = child;
+		}
+
+		if (child)
+		{
+			node->*&Node::children_mask |= 1 << child_index;
+		}
+		else
+		{
+			node->*&Node::children_mask &= ~(1 << child_index);
+		}
+	}
+
+	void SetNodeNeighbourLink(NodePtr node, uint8_t neighbour_index, NodePtr neighbour)
+	{
+		if (node.Has<CompactNode>())
+		{
+			(node->*&CompactNode::neighbours)[neighbour_index] = GetLinkSlot(neighbour);
+		}
+		else
+		{
+			(node->*&LinkedNode::neighbours)[neighbour_index] = neighbour;
+		}
+
+		if (neighbour)
+		{
+			node->*&Node::neighbour_mask |= 1 << neighbour_index;
+		}
+		else
+		{
+			node->*&Node::neighbour_mask &= ~(1 << neighbour_index);
+		}
+	}
+
 	void LinkNode(WorldPtr world, NodePtr node, uint8_t scale_index)
 	{
 		DEBUG_THREAD_CHECK_WRITE(world.Data());
@@ -154,11 +278,8 @@ namespace voxel_game::spatial3d
 			{
 				NodePtr neighbour_node = it->second;
 
-				(node->*&Node::neighbours)[neighbour_index] = neighbour_node;
-				node->*&Node::neighbour_mask |= 1 << neighbour_index;
-
-				(neighbour_node->*&Node::neighbours)[5 - neighbour_index] = node;
-				neighbour_node->*&Node::neighbour_mask |= 1 << (5 - neighbour_index);
+				SetNodeNeighbourLink(node, neighbour_index, neighbour_node);
+				SetNodeNeighbourLink(neighbour_node, 5 - neighbour_index, node);
 			}
 		}
 
@@ -174,13 +295,12 @@ namespace voxel_game::spatial3d
 			{
 				NodePtr parent_node = it->second;
 
-				node->*&Node::parent = parent_node;
-				node->*&Node::parent_index = GetNodeParentIndex(node->*&Node::position);
+				uint8_t parent_index = GetNodeParentIndex(node->*&Node::position);
 
-				DEBUG_ASSERT(node->*&Node::parent_index < 8, "The parent index is out of range");
+				DEBUG_ASSERT(parent_index < 8, "The parent index is out of range");
 
-				(parent_node->*&Node::children)[node->*&Node::parent_index] = node;
-				parent_node->*&Node::children_mask |= 1 << node->*&Node::parent_index;
+				SetNodeParentLink(node, parent_node, parent_index);
+				SetNodeChildLink(parent_node, parent_index, node);
 			}
 		}
 
@@ -199,11 +319,8 @@ namespace voxel_game::spatial3d
 				{
 					NodePtr child_node = it->second;
 
-					(node->*&Node::children)[child_index] = child_node;
-					node->*&Node::children_mask |= 1 << child_index;
-
-					child_node->*&Node::parent = node;
-					child_node->*&Node::parent_index = child_index;
+					SetNodeChildLink(node, child_index, child_node);
+					SetNodeParentLink(child_node, node, child_index);
 				}
 			}
 		}
@@ -215,19 +332,17 @@ namespace voxel_game::spatial3d
 
 		for (uint8_t neighbour_index = 0; neighbour_index < 6; neighbour_index++)
 		{
-			if (NodePtr neighbour_node = (node->*&Node::neighbours)[neighbour_index])
+			if (NodePtr neighbour_node = GetNodeNeighbour(world, node, neighbour_index))
 			{
-				(neighbour_node->*&Node::neighbours)[5 - neighbour_index] = nullptr;
-				neighbour_node->*&Node::neighbour_mask &= ~(1 << (5 - neighbour_index));
+				SetNodeNeighbourLink(neighbour_node, 5 - neighbour_index, nullptr);
 			}
 		}
 
 		if (scale_index < world->*&World::max_scale - 1)
 		{
-			if (NodePtr parent_node = node->*&Node::parent)
+			if (NodePtr parent_node = GetNodeParent(world, node))
 			{
-				(parent_node->*&Node::children)[node->*&Node::parent_index] = nullptr;
-				parent_node->*&Node::children_mask &= ~(1 << node->*&Node::parent_index);
+				SetNodeChildLink(parent_node, node->*&Node::parent_index, nullptr);
 			}
 		}
 
@@ -235,15 +350,57 @@ namespace voxel_game::spatial3d
 		{
 			for (uint8_t child_index = 0; child_index < 8; child_index++)
 			{
-				if (NodePtr child_node = (node->*&Node::children)[child_index])
+				if (NodePtr child_node = GetNodeChild(world, node, child_index))
 				{
-					child_node->*&Node::parent = nullptr;
-					child_node->*&Node::parent_index = k_node_no_parent;
+					SetNodeParentLink(child_node, nullptr, k_node_no_parent);
 				}
 			}
 		}
 	}
 
+	// Give a compact node a slot in its scales node table
+	void AllocateNodeSlot(ScalePtr scale, NodePtr node)
+	{
+		DEBUG_THREAD_CHECK_WRITE(scale.Data());
+		DEBUG_ASSERT(scale.Has<CompactScale>(), "Compact nodes need a compact scale");
+
+		std::vector<NodePtr>& node_table = scale->*&CompactScale::node_table;
+		std::vector<NodeSlot>& free_slots = scale->*&CompactScale::free_slots;
+
+		NodeSlot slot;
+
+		if (free_slots.empty())
+		{
+			slot = node_table.size();
+			node_table.push_back(node);
+		}
+		else
+		{
+			slot = free_slots.back();
+			free_slots.pop_back();
+			node_table[slot] = node;
+		}
+
+		node->*&CompactNode::slot = slot;
+	}
+
+	// Release the slot of a compact node. Its packed entities are dropped on the next pack
+	void FreeNodeSlot(ScalePtr scale, NodePtr node)
+	{
+		DEBUG_THREAD_CHECK_WRITE(scale.Data());
+
+		NodeSlot slot = node->*&CompactNode::slot;
+
+		DEBUG_ASSERT(slot != k_invalid_node_slot, "The node should have a slot");
+
+		(scale->*&CompactScale::node_table)[slot] = nullptr;
+		(scale->*&CompactScale::free_slots).push_back(slot);
+
+		(node->*&CompactNode::added_entities).clear();
+
+		node->*&CompactNode::slot = k_invalid_node_slot;
+	}
+
 	WorldPtr CreateWorld(TypeData& type, const godot::String& path)
 	{
 		DEBUG_THREAD_CHECK_READ(&type);
@@ -329,6 +486,63 @@ namespace voxel_game::spatial3d
 		type.world_type.DestroyPoly(world);
 	}
 
+	const WorldFrame& GetWorldFrame(WorldPtr world)
+	{
+		return world->*&World::frame;
+	}
+
+	void WorldUpdateFrame(WorldPtr world, WorldPtr parent, const godot::Transform3D& to_parent)
+	{
+		DEBUG_THREAD_CHECK_WRITE(world.Data());
+
+		WorldFrame& frame = world->*&World::frame;
+
+		frame.parent = parent;
+		frame.to_parent = to_parent;
+
+		if (parent)
+		{
+			DEBUG_THREAD_CHECK_READ(parent.Data());
+
+			const WorldFrame& parent_frame = parent->*&World::frame;
+
+			frame.depth = parent_frame.depth + 1;
+			frame.to_root = parent_frame.to_root * to_parent;
+		}
+		else
+		{
+			frame.depth = 0;
+			frame.to_root = to_parent;
+		}
+
+		frame.from_root = frame.to_root.affine_inverse();
+	}
+
+	godot::Vector3 ToParentSpace(WorldPtr world, const godot::Vector3& position)
+	{
+		return (world->*&World::frame).to_parent.xform(position);
+	}
+
+	godot::Vector3 ToWorldSpace(WorldPtr world, const godot::Vector3& position)
+	{
+		return (world->*&World::frame).to_root.xform(position);
+	}
+
+	godot::Vector3 FromWorldSpace(WorldPtr world, const godot::Vector3& root_position)
+	{
+		return (world->*&World::frame).from_root.xform(root_position);
+	}
+
+	godot::Vector3 ConvertWorldSpace(WorldPtr from, WorldPtr to, const godot::Vector3& position)
+	{
+		if (from == to)
+		{
+			return position;
+		}
+
+		return FromWorldSpace(to, ToWorldSpace(from, position));
+	}
+
 	size_t WorldGetNodeCount(WorldPtr world)
 	{
 		DEBUG_THREAD_CHECK_READ(world.Data());
@@ -364,10 +578,23 @@ namespace voxel_game::spatial3d
 	{
 		DEBUG_THREAD_CHECK_READ(scale.Data());
 
+		if (scale.Has<CompactScale>())
+		{
+			size_t entities = 0;
+			for (NodePtr node : scale->*&CompactScale::node_table)
+			{
+				if (node)
+				{
+					entities += node->*&CompactNode::entities_count + (node->*&CompactNode::added_entities).size();
+				}
+			}
+			return entities;
+		}
+
 		size_t entities = 0;
 		for (auto&& [pos, node] : scale->*& Scale::nodes)
 		{
-			entities += (node->*&Node::entities).size();
+			entities += (node->*&LinkedNode::entities).size();
 		}
 		return entities;
 	}
@@ -386,9 +613,65 @@ namespace voxel_game::spatial3d
 	{
 		DEBUG_THREAD_CHECK_READ(scale.Data());
 
+		WorldPtr world = scale->*&Scale::world;
+
 		for (auto&& [pos, node] : scale->*&Scale::nodes)
 		{
-			for (entity::WRef entity : node->*&Node::entities)
+			NodeForEachEntity(world, node, callback);
+		}
+	}
+
+	void NodeAddEntity(WorldPtr world, NodePtr node, entity::Ref&& entity)
+	{
+		if (node.Has<CompactNode>())
+		{
+			(node->*&CompactNode::added_entities).push_back(std::move(entity));
+		}
+		else
+		{
+			(node->*&LinkedNode::entities).push_back(std::move(entity));
+		}
+	}
+
+	size_t NodeGetEntityCount(WorldPtr world, NodePtr node)
+	{
+		if (node.Has<CompactNode>())
+		{
+			return node->*&CompactNode::entities_count + (node->*&CompactNode::added_entities).size();
+		}
+		else
+		{
+			return (node->*&LinkedNode::entities).size();
+		}
+	}
+
+	void NodeForEachEntity(WorldPtr world, NodePtr node, EntityCB callback)
+	{
+		if (node.Has<CompactNode>())
+		{
+			ScalePtr scale = GetScale(world, node->*&Node::scale_index);
+			DEBUG_THREAD_CHECK_READ(scale.Data());
+
+			const std::vector<entity::Ref>& entities = scale->*&CompactScale::entities;
+			const uint32_t begin = node->*&CompactNode::entities_begin;
+			const uint32_t end = begin + node->*&CompactNode::entities_count;
+
+			for (uint32_t index = begin; index < end; index++)
+			{
+				if (entities[index])
+				{
+					callback(entities[index]);
+				}
+			}
+
+			for (entity::WRef entity : node->*&CompactNode::added_entities)
+			{
+				callback(entity);
+			}
+		}
+		else
+		{
+			for (entity::WRef entity : node->*&LinkedNode::entities)
 			{
 				callback(entity);
 			}
@@ -601,6 +884,11 @@ namespace voxel_game::spatial3d
 					node->*&LocalNode::task_state = TaskState::Idle;
 				}
 
+				if (node.Has<CompactNode>())
+				{
+					FreeNodeSlot(scale, node);
+				}
+
 				(scale->*&Scale::nodes).erase(node->*&Node::position);
 
 				type.node_type.DestroyPoly(node);
@@ -610,7 +898,7 @@ namespace voxel_game::spatial3d
 		});
 	}
 
-	void TouchNode(ScalePtr scale, godot::Vector3i pos, Clock::time_point frame_start_time)
+	void TouchNode(ScalePtr scale, godot::Vector3i pos, uint64_t keep_until_frame, Clock::time_point frame_start_time)
 	{
 		DEBUG_THREAD_CHECK_WRITE(scale.Data());
 
@@ -633,48 +921,151 @@ namespace voxel_game::spatial3d
 			node->*&Node::scale_index = scale->*&Scale::index;
 			node->*&Node::state = NodeState::Loading;
 
+			if (node.Has<CompactNode>())
+			{
+				AllocateNodeSlot(scale, node);
+			}
+
 			(scale->*&PartialScale::loading_nodes).push_back(pos);
 		}
 
 		// Touch the node so it stays loaded
 		node->*&PartialNode::last_update_time = frame_start_time;
+		node->*&PartialNode::keep_until_frame = std::max(node->*&PartialNode::keep_until_frame, keep_until_frame);
 	}
 
-	void LoaderLoadNodes(ScalePtr scale, entity::WRef loader, Clock::time_point frame_start_time, double scale_node_step)
+	// A loaders sphere of nodes at a single scale
+	struct LoaderSphere
 	{
-		DEBUG_THREAD_CHECK_WRITE(scale.Data());
-		EASY_BLOCK("SingleLoader");
+		godot::Vector3i center;
+		int32_t radius = 0;
+
+		// The frame the loader is next due. Its nodes are kept until then even if that is past the keepalive
+		uint64_t keep_until_frame = 0;
+	};
+
+	// Check if a loader should do its work this frame. Loaders are staggered by their id so that
+	// loaders with the same frequency don't all update on the same frame
+	bool IsLoaderDue(entity::WRef loader, uint64_t frame_index)
+	{
+		const uint8_t update_frequency = loader->*&CLoader::update_frequency;
 
-		if (scale->*&Scale::index < loader->*&CLoader::min_lod || scale->*&Scale::index > loader->*&CLoader::max_lod)
+		if (update_frequency <= 1)
 		{
-			return;
+			return true;
+		}
+
+		return (frame_index + loader.GetID().m_data[0]) % update_frequency == 0;
+	}
+
+	// Check if the first sphere is fully inside the second
+	bool IsSphereContained(const LoaderSphere& inner, const LoaderSphere& outer)
+	{
+		if (inner.radius > outer.radius)
+		{
+			return false;
 		}
 
+		const int64_t radius_diff = outer.radius - inner.radius;
+
+		return (inner.center - outer.center).length_squared() <= radius_diff * radius_diff;
+	}
+
+	void LoaderSphereLoadNodes(ScalePtr scale, const LoaderSphere& sphere, Clock::time_point frame_start_time)
+	{
+		DEBUG_THREAD_CHECK_WRITE(scale.Data());
+		EASY_BLOCK("SingleLoader");
+
+		// Add 0.5 so that the sphere is centered on the loaders node
+		const godot::Vector3 center = godot::Vector3(sphere.center) + godot::Vector3(0.5, 0.5, 0.5);
+
 		// For each node in the sphere of the loader
-		ForEachCoordInSphere(loader->*&CPosition::position / scale_node_step, loader->*&CLoader::dist_per_lod, [&](godot::Vector3i pos)
+		ForEachCoordInSphere(center, sphere.radius, [&](godot::Vector3i pos)
 		{
-			TouchNode(scale, pos, frame_start_time);
+			TouchNode(scale, pos, sphere.keep_until_frame, frame_start_time);
 		});
 	}
 
-	void ScaleLoadNodesAroundLoaders(ScalePtr scale, Clock::time_point frame_start_time)
+	void ScaleLoadNodesAroundLoaders(ScalePtr scale, const entity::Factory& entity_factory, uint64_t frame_index, Clock::time_point frame_start_time)
 	{
 		DEBUG_THREAD_CHECK_WRITE(scale.Data());
 
 		WorldPtr world = scale->*&Scale::world;
 		DEBUG_THREAD_CHECK_READ(world.Data());
 
-		const uint32_t scale_step = 1 << scale->*&Scale::index;
+		const uint8_t scale_index = scale->*&Scale::index;
+		const uint32_t scale_step = 1 << scale_index;
 		const double scale_node_step = scale_step * world->*&World::node_size;
 
-		// For each command list that is a child of the world
-		for (entity::WRef loader : world->*&PartialWorld::loaders)
+		// Gather the spheres of all loaders that want to load this scale this frame. Loaders are snapped
+		// to the center of the node they are in instead of using their exact position so that loaders
+		// close to each other produce identical spheres that can be merged. The loaded area moves in
+		// whole node steps as a loader moves
+		GrowingSmallVector<LoaderSphere, 64> spheres;
+
+		for (entity::Handle handle : world->*&PartialWorld::loaders)
 		{
-			LoaderLoadNodes(scale, loader, frame_start_time, scale_node_step);
+			entity::WRef loader = entity_factory.Resolve(handle);
+
+			if (!loader)
+			{
+				continue;
+			}
+
+			if (scale_index < loader->*&CLoader::min_lod || scale_index > loader->*&CLoader::max_lod)
+			{
+				continue;
+			}
+
+			if (!IsLoaderDue(loader, frame_index))
+			{
+				continue;
+			}
+
+			godot::Vector3 position = loader->*&CPosition::position / scale_node_step;
+
+			const uint64_t update_frequency = std::max<uint8_t>(loader->*&CLoader::update_frequency, 1);
+
+			spheres.emplace_back(LoaderSphere{ position.floor(), loader->*&CLoader::dist_per_lod, frame_index + update_frequency });
+		}
+
+		// Merge loaders whose sphere is inside another loaders sphere. When spheres are identical
+		// only the first one is kept
+		for (size_t i = 0; i < spheres.size(); i++)
+		{
+			bool merged = false;
+
+			for (size_t j = 0; j < spheres.size() && !merged; j++)
+			{
+				if (i == j || !IsSphereContained(spheres[i], spheres[j]))
+				{
+					continue;
+				}
+
+				merged = j < i || !IsSphereContained(spheres[j], spheres[i]);
+			}
+
+			if (merged)
+			{
+				continue;
+			}
+
+			// Keep the nodes of the merged loaders until they are due again as well
+			LoaderSphere sphere = spheres[i];
+
+			for (size_t j = 0; j < spheres.size(); j++)
+			{
+				if (IsSphereContained(spheres[j], sphere))
+				{
+					sphere.keep_until_frame = std::max(sphere.keep_until_frame, spheres[j].keep_until_frame);
+				}
+			}
+
+			LoaderSphereLoadNodes(scale, sphere, frame_start_time);
 		}
 	}
 
-	void ScaleUnloadUnutilizedNodes(ScalePtr scale, Clock::time_point frame_start_time)
+	void ScaleUnloadUnutilizedNodes(ScalePtr scale, uint64_t frame_index, Clock::time_point frame_start_time)
 	{
 		DEBUG_THREAD_CHECK_WRITE(scale.Data());
 
@@ -689,8 +1080,10 @@ namespace voxel_game::spatial3d
 				continue;
 			}
 
-			// Check if node hasn't been touched in too long
-			bool node_untouched = frame_start_time - node->*&PartialNode::last_update_time > world->*&PartialWorld::node_keepalive;
+			// Check if node hasn't been touched in too long. Throttled loaders count in frames and not time so
+			// wait for them to have missed their next update as well
+			bool node_untouched = frame_start_time - node->*&PartialNode::last_update_time > world->*&PartialWorld::node_keepalive &&
+				frame_index > node->*&PartialNode::keep_until_frame;
 
 			if (world->*&World::unloading || node_untouched)
 			{
@@ -706,17 +1099,59 @@ namespace voxel_game::spatial3d
 		}
 	}
 
+	// Move packed entities that want to be in another scale to the node they should be in there. Their reference in
+	// the packed array is left empty until the next pack
+	void CompactScaleUpdateEntityScales(WorldPtr world, ScalePtr scale)
+	{
+		std::vector<entity::Ref>& entities = scale->*&CompactScale::entities;
+
+		for (entity::Ref& entity : entities)
+		{
+			if (!entity || !entity.Has<CPosition>())
+			{
+				continue;
+			}
+
+			const uint8_t scale_index = entity->*&CPosition::scale;
+
+			if (scale_index == scale->*&Scale::index || scale_index >= world->*&World::max_scale)
+			{
+				continue;
+			}
+
+			ScalePtr new_scale = GetScale(world, scale_index);
+
+			const double scale_node_step = double(1 << scale_index) * world->*&World::node_size;
+			godot::Vector3i required_node_pos = (entity->*&CPosition::position / scale_node_step).floor();
+
+			NodeMap::const_iterator it = (new_scale->*&Scale::nodes).find(required_node_pos);
+
+			// If the required node is not loaded then wait until it is loaded
+			if (it != (new_scale->*&Scale::nodes).end() && it->second && it->second->*&Node::state == NodeState::Loaded)
+			{
+				NodeAddEntity(world, it->second, std::move(entity));
+				entity = entity::Ref();
+			}
+		}
+	}
+
 	void WorldUpdateEntityScales(WorldPtr world)
 	{
 		DEBUG_THREAD_CHECK_WRITE(world.Data());
 
 		WorldForEachScale(world, [&](ScalePtr scale)
 		{
+			if (scale.Has<CompactScale>())
+			{
+				CompactScaleUpdateEntityScales(world, scale);
+				return;
+			}
+
 			NodeMap scale_nodes = scale->*&Scale::nodes;
 
 			for (auto&& [pos, node] : scale_nodes)
 			{
-				for (auto node_it = (node->*&Node::entities).begin(); node_it != (node->*&Node::entities).end(); node_it++)
+				for (auto node_it = (node->*&LinkedNode::entities).begin(); node_it != (node->*&LinkedNode::entities).end(); node_it++)
 				{
 					entity::WRef entity = *node_it;
 
@@ -736,23 +1171,135 @@ namespace voxel_game::spatial3d
 					{
 						NodePtr new_node = new_it->second;
 
-						node_it = (node->*&Node::entities).erase(node_it);
-						(new_node->*&Node::entities).push_back(entity::Ref(entity));
+						node_it = (node->*&LinkedNode::entities).erase(node_it);
+						NodeAddEntity(world, new_node, entity::Ref(entity));
 					}
 				}
 			}
 		});
 	}
 
-	void ScaleUpdateEntityNodes(ScalePtr scale)
+	// Get the slot of the node an entity should be in or the slot its in now if that node isn't loaded
+	NodeSlot GetEntityTargetSlot(ScalePtr scale, entity::WRef entity, NodeSlot current_slot, double scale_node_step)
+	{
+		if (!entity.Has<CPosition>())
+		{
+			return current_slot;
+		}
+
+		godot::Vector3i required_node_pos = (entity->*&CPosition::position / scale_node_step).floor();
+
+		NodeMap::const_iterator it = (scale->*&Scale::nodes).find(required_node_pos);
+
+		if (it == (scale->*&Scale::nodes).end() || !it->second || it->second->*&Node::state != NodeState::Loaded)
+		{
+			return current_slot;
+		}
+
+		return it->second->*&CompactNode::slot;
+	}
+
+	// Rebuild the packed entity array of a compact scale with a counting sort by node slot. Entities added
+	// since the last pack are merged in, entities that moved are given to their new node and entities of
+	// freed slots are dropped
+	void ScalePackEntities(ScalePtr scale, FrameArena& arena)
 	{
 		DEBUG_THREAD_CHECK_WRITE(scale.Data());
 
+		WorldPtr world = scale->*&Scale::world;
+
+		std::vector<NodePtr>& node_table = scale->*&CompactScale::node_table;
+		std::vector<entity::Ref>& entities = scale->*&CompactScale::entities;
+
+		const double scale_node_step = double(1 << scale->*&Scale::index) * world->*&World::node_size;
+
+		// Find which slot each entity belongs to. Entities of freed slots and entities that moved to another
+		// scale are skipped
+		FrameVector<std::pair<NodeSlot, entity::Ref*>> targets(arena);
+		targets.reserve(entities.size());
+
+		FrameVector<uint32_t> slot_counts(node_table.size() + 1, 0, arena);
+
+		for (NodeSlot slot = 0; slot < node_table.size(); slot++)
+		{
+			NodePtr node = node_table[slot];
+
+			if (!node)
+			{
+				continue;
+			}
+
+			const uint32_t begin = node->*&CompactNode::entities_begin;
+			const uint32_t end = begin + node->*&CompactNode::entities_count;
+
+			for (uint32_t index = begin; index < end; index++)
+			{
+				if (!entities[index])
+				{
+					continue;
+				}
+
+				NodeSlot target = GetEntityTargetSlot(scale, entities[index], slot, scale_node_step);
+				targets.emplace_back(target, &entities[index]);
+				slot_counts[target + 1]++;
+			}
+
+			for (entity::Ref& entity : node->*&CompactNode::added_entities)
+			{
+				NodeSlot target = GetEntityTargetSlot(scale, entity, slot, scale_node_step);
+				targets.emplace_back(target, &entity);
+				slot_counts[target + 1]++;
+			}
+		}
+
+		// Turn the counts into the start of each slots range
+		for (size_t slot = 1; slot < slot_counts.size(); slot++)
+		{
+			slot_counts[slot] += slot_counts[slot - 1];
+		}
+
+		for (NodeSlot slot = 0; slot < node_table.size(); slot++)
+		{
+			if (NodePtr node = node_table[slot])
+			{
+				node->*&CompactNode::entities_begin = slot_counts[slot];
+				node->*&CompactNode::entities_count = slot_counts[slot + 1] - slot_counts[slot];
+			}
+		}
+
+		std::vector<entity::Ref> packed_entities(targets.size());
+
+		for (auto&& [target, entity] : targets)
+		{
+			packed_entities[slot_counts[target]++] = std::move(*entity);
+		}
+
+		entities = std::move(packed_entities);
+
+		for (NodePtr node : node_table)
+		{
+			if (node)
+			{
+				(node->*&CompactNode::added_entities).clear();
+			}
+		}
+	}
+
+	void ScaleUpdateEntityNodes(ScalePtr scale, FrameArena& arena)
+	{
+		DEBUG_THREAD_CHECK_WRITE(scale.Data());
+
+		if (scale.Has<CompactScale>())
+		{
+			ScalePackEntities(scale, arena);
+			return;
+		}
+
 		NodeMap scale_nodes = scale->*&Scale::nodes;
 
 		for (auto&& [pos, node] : scale_nodes)
 		{
-			for (auto node_it = (node->*&Node::entities).begin(); node_it != (node->*&Node::entities).end(); node_it++)
+			for (auto node_it = (node->*&LinkedNode::entities).begin(); node_it != (node->*&LinkedNode::entities).end(); node_it++)
 			{
 				entity::WRef entity = *node_it;
 
@@ -770,8 +1317,8 @@ namespace voxel_game::spatial3d
 				{
 					NodePtr new_node = new_it->second;
 
-					node_it = (node->*&Node::entities).erase(node_it);
-					(new_node->*&Node::entities).push_back(entity::Ref(entity));
+					node_it = (node->*&LinkedNode::entities).erase(node_it);
+					(new_node->*&LinkedNode::entities).push_back(entity::Ref(entity));
 				}
 			}
 		}
@@ -9,9 +9,11 @@
 #include "Util/GodotHash.h"
 #include "Util/Callback.h"
 #include "Util/Serialize.h"
+#include "Util/FrameArena.h"
 
 #include <godot_cpp/variant/vector3.hpp>
 #include <godot_cpp/variant/vector3i.hpp>
+#include <godot_cpp/variant/transform3d.hpp>
 
 #include <robin_hood/robin_hood.h>
 
@@ -46,6 +48,7 @@ namespace voxel_game::spatial3d
 	struct PartialNode : Nocopy, Nomove
 	{
 		Clock::time_point last_update_time; // Time since a loader last updated our unload timer
+		uint64_t keep_until_frame = 0; // Throttled loaders keep us loaded until the frame they are next due
 	};
 
 	struct PartialScale : Nocopy, Nomove
@@ -59,8 +62,9 @@ namespace voxel_game::spatial3d
 	{
 		Clock::duration node_keepalive = 0s;
 
-		// Optional entities that act as areas where nodes are loaded around
-		std::vector<entity::WRef> loaders;
+		// Optional entities that act as areas where nodes are loaded around. Handles are used so that
+		// a loader destroyed without being unloaded is skipped instead of left dangling
+		std::vector<entity::Handle> loaders;
 	};
 
 	// ----- Local -----
@@ -132,6 +136,16 @@ namespace voxel_game::spatial3d
 		uint8_t children_mask = 0; // Each bit determines a child [0-7]
 		uint8_t neighbour_mask = 0; // Each bit determines a neighbour [0-5]
 
+		NodeState state = NodeState::Invalid;
+	};
+
+	using NodeMap = robin_hood::unordered_map<godot::Vector3i, NodePtr>;
+
+	// ----- Linked -----
+
+	// The default node layout where links are pointers to other nodes and each node owns its entities
+	struct LinkedNode : Nocopy, Nomove
+	{
 		NodePtr parent = nullptr; // Octree parent
 
 		NodePtr children[8] = { nullptr }; // Octree children
@@ -139,11 +153,46 @@ namespace voxel_game::spatial3d
 		NodePtr neighbours[6] = { nullptr }; // Fast access of neighbours of same scale
 
 		std::vector<entity::Ref> entities;
+	};
 
-		NodeState state = NodeState::Invalid;
+	// ----- Compact -----
+
+	using NodeSlot = uint32_t;
+
+	constexpr const NodeSlot k_invalid_node_slot = UINT32_MAX;
+
+	// An alternative node layout for worlds with many small nodes. Links are slots into the node table of
+	// the scale they are in and entities are stored in a packed array in the scale
+	struct CompactNode : Nocopy, Nomove
+	{
+		NodeSlot slot = k_invalid_node_slot; // Our slot in our scales node table
+
+		NodeSlot parent = k_invalid_node_slot; // Slot in the parent scale
+
+		NodeSlot children[8] = { k_invalid_node_slot, k_invalid_node_slot, k_invalid_node_slot, k_invalid_node_slot,
+			k_invalid_node_slot, k_invalid_node_slot, k_invalid_node_slot, k_invalid_node_slot }; // Slots in the child scale
+
+		NodeSlot neighbours[6] = { k_invalid_node_slot, k_invalid_node_slot, k_invalid_node_slot,
+			k_invalid_node_slot, k_invalid_node_slot, k_invalid_node_slot }; // Slots in our scale
+
+		// Range of our entities in the scales packed entity array
+		uint32_t entities_begin = 0;
+		uint32_t entities_count = 0;
+
+		// Entities added since the last pack. Kept in the node so that nodes can be generated in parallel
+		std::vector<entity::Ref> added_entities;
 	};
 
-	using NodeMap = robin_hood::unordered_map<godot::Vector3i, NodePtr>;
+	struct CompactScale : Nocopy, Nomove
+	{
+		// All nodes of the scale indexed by their slot. Free slots are nullptr
+		std::vector<NodePtr> node_table;
+		std::vector<NodeSlot> free_slots;
+
+		// Entities of all nodes packed together by node. Entities that moved to another scale leave an empty
+		// reference behind until the next pack
+		std::vector<entity::Ref> entities;
+	};
 
 	// A level of detail map for a world. The world will have multiple of these
 	struct Scale : Nocopy, Nomove
@@ -156,11 +205,27 @@ namespace voxel_game::spatial3d
 		NodeMap nodes;
 	};
 
+	// The coordinate frame of a world relative to the world it is in and to the root world. These are
+	// cached once per frame so that conversions between worlds don't need to walk the entity parents
+	struct WorldFrame
+	{
+		WorldPtr parent; // The world our entity is in or nullptr if we are a root world
+		uint8_t depth = 0; // The number of worlds above us
+
+		godot::Transform3D to_parent;
+		godot::Transform3D to_root;
+		godot::Transform3D from_root;
+	};
+
 	// A spatial database which has an octree like structure with neighbour pointers and hash maps for each lod. 
 	struct World : Nocopy, Nomove
 	{
 		TypeData* type = nullptr;
 
+		entity::WRef entity; // The entity that this world belongs to
+
+		WorldFrame frame;
+
 		uint8_t max_scale = 0;
 		uint8_t node_size = 0;
 
@@ -209,6 +274,22 @@ namespace voxel_game::spatial3d
 	// Get a node in a world at a position and scale
 	NodePtr GetNode(WorldPtr world, godot::Vector3i position, uint8_t scale_index);
 
+	// Get the parent of a node or nullptr if it has none. Works for both node layouts
+	NodePtr GetNodeParent(WorldPtr world, NodePtr node);
+
+	// Get a child of a node or nullptr if it has none. Works for both node layouts
+	NodePtr GetNodeChild(WorldPtr world, NodePtr node, uint8_t child_index);
+
+	// Get a neighbour of a node or nullptr if it has none. Works for both node layouts
+	NodePtr GetNodeNeighbour(WorldPtr world, NodePtr node, uint8_t neighbour_index);
+
+	// Add an entity to a node. Thread safe for that nodes scale
+	void NodeAddEntity(WorldPtr world, NodePtr node, entity::Ref&& entity);
+
+	size_t NodeGetEntityCount(WorldPtr world, NodePtr node);
+
+	void NodeForEachEntity(WorldPtr world, NodePtr node, EntityCB callback);
+
 	// Create a new spatial world given provided types
 	WorldPtr CreateWorld(TypeData& type, const godot::String& path);
 
@@ -228,21 +309,42 @@ namespace voxel_game::spatial3d
 
 	void WorldForEachScale(WorldPtr world, ScaleCB callback);
 
+	// Get the cached coordinate frame of a world
+	const WorldFrame& GetWorldFrame(WorldPtr world);
+
+	// Update the cached frame of a world. The parents frame should have been updated first. Thread safe for that world
+	void WorldUpdateFrame(WorldPtr world, WorldPtr parent, const godot::Transform3D& to_parent);
+
+	// Convert a position in a world to the space of the world it is in
+	godot::Vector3 ToParentSpace(WorldPtr world, const godot::Vector3& position);
+
+	// Convert a position in a world to the space of the root world
+	godot::Vector3 ToWorldSpace(WorldPtr world, const godot::Vector3& position);
+
+	// Convert a position in the root world to the space of a world
+	godot::Vector3 FromWorldSpace(WorldPtr world, const godot::Vector3& root_position);
+
+	// Convert a position in one world to the space of another world in the same hierarchy
+	godot::Vector3 ConvertWorldSpace(WorldPtr from, WorldPtr to, const godot::Vector3& position);
+
 	// Execute all node create commands a world has. Thread safe for that world
 	void WorldDoNodeLoadCommands(WorldPtr world, Clock::time_point frame_start_time);
 
 	// Execute all node destroy commands a world has. Thread safe for that world
 	void WorldDoNodeUnloadCommands(WorldPtr world);
 
-	// Add commands to load all nodes around loaders. Thread safe for that scale
-	void ScaleLoadNodesAroundLoaders(ScalePtr scale, Clock::time_point frame_start_time);
+	// Add commands to load all nodes around loaders that are due an update this frame. Loaders that are
+	// inside another loaders sphere for this scale are merged into it. Thread safe for that scale
+	void ScaleLoadNodesAroundLoaders(ScalePtr scale, const entity::Factory& entity_factory, uint64_t frame_index, Clock::time_point frame_start_time);
 
-	// Add commands to unload nodes that are not near loaders. Thread safe for that scale
-	void ScaleUnloadUnutilizedNodes(ScalePtr scale, Clock::time_point frame_start_time);
+	// Add commands to unload nodes that are not near loaders. Nodes are kept past the keepalive until the loaders
+	// that touched them are due again. Thread safe for that scale
+	void ScaleUnloadUnutilizedNodes(ScalePtr scale, uint64_t frame_index, Clock::time_point frame_start_time);
 
 	// Update the scale entities should be in based on their position. Thread safe for that world
 	void WorldUpdateEntityScales(WorldPtr world);
 
-	// Update the node entities should be in based on their position. Thread safe for that scale
-	void ScaleUpdateEntityNodes(ScalePtr scale);
+	// Update the node entities should be in based on their position. For compact scales this also packs
+	// the scales entity array using the arena for scratch memory. Thread safe for that scale
+	void ScaleUpdateEntityNodes(ScalePtr scale, FrameArena& arena);
 }
\ No newline at end of file
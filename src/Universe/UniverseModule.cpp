@@ -14,13 +14,7 @@
 
 namespace voxel_game::universe
 {
-	const entity::TypeID k_universe_type = entity::Factory::Archetype::CreateTypeID<
-		CUniverse,
-		CRelationship,
-		CWorld,
-		CScenario,
-		CTransform
-	>();
+	const entity::TypeID k_universe_type = UniverseType::GetID();
 
 	void LoadNodeRandomly(Simulation& simulation, spatial3d::WorldPtr world, spatial3d::NodePtr node)
 	{
@@ -92,7 +86,7 @@ namespace voxel_game::universe
 
 			entity::Ref entity = SimulationCreateEntity(simulation, id, types);
 
-			(node->*&spatial3d::Node::entities).push_back(entity.Reference());
+			spatial3d::NodeAddEntity(world, node, entity.Reference());
 			(node->*&Node::galaxies).push_back(entity);
 		}
 	}
@@ -111,13 +105,23 @@ namespace voxel_game::universe
 
 		position.y -= node->*&spatial3d::Node::scale_index - 1;
 
-		for (size_t i = 0; i < 4; i++)
+		std::array<UUID, 4> ids;
+
+		for (UUID& id : ids)
 		{
-			entity::Ref galaxy_entity = SimulationCreateEntity(simulation, GenerateUUID(), galaxy::k_galaxy_type);
+			id = GenerateUUID();
+		}
 
-			galaxy_entity->*&CPosition::position = position;
+		std::vector<entity::Ref> galaxy_entities;
 
-			(node->*&spatial3d::Node::entities).push_back(galaxy_entity.Reference());
+		SimulationInstantiateEntities(simulation, *simulation.galaxy_prefab, ids, galaxy_entities);
+
+		for (entity::Ref& galaxy_entity : galaxy_entities)
+		{
+			// Galaxies are laid out by GalaxyType so their components are at constant offsets
+			galaxy::GalaxyType::Get<CPosition>(galaxy_entity.GetHeader()).position = position;
+
+			spatial3d::NodeAddEntity(world, node, galaxy_entity.Reference());
 			(node->*&Node::galaxies).push_back(galaxy_entity);
 		}
 	}
@@ -128,12 +132,15 @@ namespace voxel_game::universe
 		simulation.universe_type.node_keepalive = 1s;
 
 		simulation.universe_type.node_type.AddType<spatial3d::Node>();
+		// Universes have many small nodes so they use the compact layout
+		simulation.universe_type.node_type.AddType<spatial3d::CompactNode>();
 		simulation.universe_type.node_type.AddType<spatial3d::PartialNode>();
 		simulation.universe_type.node_type.AddType<spatial3d::LocalNode>();
 		simulation.universe_type.node_type.AddType<Node>();
 
 		simulation.universe_type.scale_type.AddType<spatial3d::Scale>();
 		simulation.universe_type.scale_type.AddType<spatial3d::PartialScale>();
+		simulation.universe_type.scale_type.AddType<spatial3d::CompactScale>();
 		simulation.universe_type.scale_type.AddType<Scale>();
 
 		simulation.universe_type.world_type.AddType<spatial3d::World>();
@@ -153,6 +160,8 @@ namespace voxel_game::universe
 		simulation.universe_type.deserialize_callbacks.push_back(cb::BindArg<&DeserializeUniverseNode>(simulation));
 		simulation.universe_type.generate_callbacks.push_back(cb::BindArg<&GenerateUniverseNode>(simulation));
 
+		simulation.entity_factory.UseStaticType<UniverseType>();
+
 		simulation.entity_factory.AddCallback<CUniverse>(PolyEvent::MainUpdate, cb::BindArg<&OnUpdateUniverseEntity>(simulation));
 		simulation.entity_factory.AddCallback<CUniverse>(PolyEvent::BeginLoad, cb::BindArg<&OnLoadUniverseEntity>(simulation));
 		simulation.entity_factory.AddCallback<CUniverse>(PolyEvent::BeginUnload, cb::BindArg<&OnUnloadUniverseEntity>(simulation));
@@ -192,8 +201,10 @@ namespace voxel_game::universe
 	{
 		entity::Ref entity = SimulationCreateEntity(simulation, id, k_universe_type);
 
-		entity->*&CWorld::path = simulation.path;
-		entity->*&CWorld::type = WorldConstructType::Universe;
+		CWorld& world = UniverseType::Get<CWorld>(entity.GetHeader());
+
+		world.path = simulation.path;
+		world.type = WorldConstructType::Universe;
 
 		return entity;
 	}
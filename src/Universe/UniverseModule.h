@@ -7,10 +7,25 @@
 namespace voxel_game
 {
 	struct Simulation;
+
+	struct CUniverse;
+	struct CRelationship;
+	struct CWorld;
+	struct CScenario;
+	struct CTransform;
 }
 
 namespace voxel_game::universe
 {
+	// Universes have a fixed layout so their components can be accessed with constant offsets
+	using UniverseType = StaticPolyType<entity::Factory::Archetype,
+		CUniverse,
+		CRelationship,
+		CWorld,
+		CScenario,
+		CTransform
+	>;
+
 	extern const entity::TypeID k_universe_type;
 
 	// Module functions
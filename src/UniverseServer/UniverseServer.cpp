@@ -10,6 +10,7 @@
 #include "Util/Debug.h"
 
 #include <godot_cpp/classes/display_server.hpp>
+#include <godot_cpp/classes/file_access.hpp>
 #include <godot_cpp/classes/os.hpp>
 #include <godot_cpp/classes/engine.hpp>
 #include <godot_cpp/classes/project_settings.hpp>
@@ -19,12 +20,11 @@
 
 #include <easy/profiler.h>
 
-#define BIND_METHOD godot::ClassDB::bind_method
+// Methods are bound as commands so that deferred calls to them can be recorded
+#define BIND_METHOD(definition, method) BindCommand<method>(definition)
 
 namespace voxel_game
 {
-	const size_t k_simulation_ticks_per_second = 20;
-
 	godot::OptObj<UniverseServer> UniverseServer::k_singleton;
 
 	std::optional<const UniverseServer::SignalStrings> UniverseServer::k_signals;
@@ -39,6 +39,8 @@ namespace voxel_game
 
 	UniverseServer::~UniverseServer()
 	{
+		StopAllShards();
+
 		WaitUntilStopped();
 	}
 
@@ -51,15 +53,22 @@ namespace voxel_game
 	{
 		m_simulation = std::make_unique<Simulation>();
 
-		m_simulation->modules.push_back(simulation_module_schematic);
-		m_simulation->modules.push_back(rendering_module_schematic);
-		m_simulation->modules.push_back(debugrender_module_schematic);
-		m_simulation->modules.push_back(spatial3d_module_schematic);
-		m_simulation->modules.push_back(universe_module_schematic);
-		m_simulation->modules.push_back(galaxy_module_schematic);
+		if (godot::OS::get_singleton()->has_feature("dedicated_server"))
+		{
+			m_simulation->job_system = &GetJobSystem();
+		}
+
+		m_simulation->worker_share = std::min<uint64_t>(m_worker_share.load(std::memory_order_relaxed), UINT8_MAX);
+
+		AddSimulationModules(*m_simulation);
 
 		SimulationInitialize(*m_simulation);
 
+		{
+			std::lock_guard lock(m_simulation_mutex);
+			m_simulation_loaded = true;
+		}
+
 #if defined(DEBUG_ENABLED)
 		m_info_updater.SetWriterThread(std::this_thread::get_id());
 #endif
@@ -67,6 +76,11 @@ namespace voxel_game
 
 	void UniverseServer::DoSimulationUnload()
 	{
+		{
+			std::lock_guard lock(m_simulation_mutex);
+			m_simulation_loaded = false;
+		}
+
 #if defined(DEBUG_ENABLED)
 		m_info_updater.SetWriterThread(std::thread::id{}); // We may not start in thread mode next time
 #endif
@@ -153,12 +167,67 @@ namespace voxel_game
 	}
 #endif
 
+	godot::Dictionary UniverseServer::GetTimingStats()
+	{
+		// Holding the lock keeps the simulation and its contexts alive
+		std::lock_guard lock(m_simulation_mutex);
+
+		if (!m_simulation_loaded)
+		{
+			return godot::Dictionary();
+		}
+
+		return simulation::GetTimingStats(*m_simulation);
+	}
+
+	// Write the latest frames as a chrome trace that can be opened in chrome://tracing or Perfetto
+	bool UniverseServer::DumpTimingTrace(const godot::String& path)
+	{
+		godot::String trace;
+
+		{
+			std::lock_guard lock(m_simulation_mutex);
+
+			if (!m_simulation_loaded)
+			{
+				return false;
+			}
+
+			trace = simulation::GetChromeTrace(*m_simulation);
+		}
+
+		godot::Ref<godot::FileAccess> file = godot::FileAccess::open(path, godot::FileAccess::WRITE);
+
+		if (file.is_null() || file->get_error() != godot::Error::OK)
+		{
+			DEBUG_PRINT_ERROR(godot::vformat("Failed to open the file %s", path));
+			return false;
+		}
+
+		file->store_string(trace);
+
+		file->close();
+
+		return true;
+	}
+
 	godot::String UniverseServer::GenerateDebugInfo()
 	{
 		godot::String debug_info;
 
 		debug_info += godot::vformat("FPS: %d\n", godot::Engine::get_singleton()->get_frames_per_second());
 		debug_info += godot::vformat("Frame Index: %d\n", m_simulation->frame_index);
+
+		size_t arena_used = 0;
+		size_t arena_high_water_mark = 0;
+		size_t arena_capacity = 0;
+		for (ThreadContext& context : m_simulation->thread_contexts)
+		{
+			arena_used += context.arena.GetUsed();
+			arena_high_water_mark += context.arena.GetHighWaterMark();
+			arena_capacity += context.arena.GetCapacity();
+		}
+		debug_info += godot::vformat("Frame Arenas: %d / %d bytes (High Water Mark: %d)\n", arena_used, arena_capacity, arena_high_water_mark);
 		debug_info += "\n";
 
 		size_t node_count = 0;
@@ -188,6 +257,16 @@ namespace voxel_game
 #if defined(DEBUG_ENABLED)
 		BIND_METHOD(godot::D_METHOD("debug_command", "command", "arguments"), &UniverseServer::DebugCommand);
 #endif
+		BIND_METHOD(godot::D_METHOD("get_timing_stats"), &UniverseServer::GetTimingStats);
+		BIND_METHOD(godot::D_METHOD("dump_timing_trace", "path"), &UniverseServer::DumpTimingTrace);
+		BIND_METHOD(godot::D_METHOD("run_benchmark", "path", "universe_count", "galaxy_count", "tick_count", "worker_count"), &UniverseServer::RunBenchmark);
+
+		BIND_METHOD(godot::D_METHOD("start_shard", "path", "worker_share"), &UniverseServer::StartShard);
+		BIND_METHOD(godot::D_METHOD("stop_shard", "shard_id"), &UniverseServer::StopShard);
+		BIND_METHOD(godot::D_METHOD("get_shards"), &UniverseServer::GetShards);
+		BIND_METHOD(godot::D_METHOD("get_shard_timing_stats", "shard_id"), &UniverseServer::GetShardTimingStats);
+		BIND_METHOD(godot::D_METHOD("set_worker_share", "worker_share"), &UniverseServer::SetWorkerShare);
+		BIND_METHOD(godot::D_METHOD("get_worker_share"), &UniverseServer::GetWorkerShare);
 		BIND_METHOD(godot::D_METHOD("get_universe_info"), &UniverseServer::GetUniverseInfo);
 		BIND_METHOD(godot::D_METHOD("connect_to_universe_list", "ip"), &UniverseServer::ConnectToUniverseList);
 		BIND_METHOD(godot::D_METHOD("disconnect_from_universe_list"), &UniverseServer::DisconnectFromUniverseList);
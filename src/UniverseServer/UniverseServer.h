@@ -7,6 +7,7 @@
 #include "Entity/EntityPoly.h"
 
 #include "Util/PolyFactory.h"
+#include "Util/JobSystem.h"
 #include "Util/GodotMemory.h"
 #include "Util/SmallVector.h"
 #include "Util/Debug.h"
@@ -18,6 +19,10 @@
 #include <godot_cpp/variant/vector4.hpp>
 #include <godot_cpp/variant/vector4i.hpp>
 
+#include <godot_cpp/variant/packed_int64_array.hpp>
+
+#include <atomic>
+#include <mutex>
 #include <optional>
 #include <thread>
 
@@ -58,6 +63,32 @@ namespace voxel_game
 		void DebugCommand(const godot::StringName& command, const godot::Array& args);
 #endif
 
+		// ####### Timing #######
+
+		godot::Dictionary GetTimingStats();
+		bool DumpTimingTrace(const godot::String& path);
+
+		// ####### Benchmark #######
+
+		// Run a separate simulation with a number of universes and simulated galaxies for some ticks and return how long it took.
+		// Only runs while no other simulation is loaded. A negative worker count uses one worker less than there are processors
+		godot::Dictionary RunBenchmark(const godot::String& path, uint64_t universe_count, uint64_t galaxy_count, uint64_t tick_count, int64_t worker_count);
+
+		// ####### Shards #######
+
+		// Start a headless simulation of a universe with one simulated galaxy on its own thread. Shards share the job system
+		// with each other and the main simulation and use at most worker share workers of it at once. Zero uses all of them
+		int64_t StartShard(const godot::String& path, uint64_t worker_share);
+		void StopShard(int64_t shard_id);
+		godot::PackedInt64Array GetShards();
+
+		// The timing stats of a shard along with overload_count, how many times it fell behind and dropped ticks
+		godot::Dictionary GetShardTimingStats(int64_t shard_id);
+
+		// How many workers the main simulation may use at once. Applies the next time it loads
+		void SetWorkerShare(uint64_t worker_share);
+		uint64_t GetWorkerShare();
+
 		// ####### Universe #######
 
 		godot::Dictionary GetUniverseInfo();
@@ -306,8 +337,14 @@ namespace voxel_game
 		static void _cleanup_methods();
 
 	private:
+		struct Shard;
+
 		godot::String GenerateDebugInfo();
 
+		JobSystem& GetJobSystem();
+		void RunShard(Shard& shard, const godot::String& path);
+		void StopAllShards();
+
 	private:
 		static godot::OptObj<UniverseServer> k_singleton;
 
@@ -316,6 +353,22 @@ namespace voxel_game
 
 		std::unique_ptr<Simulation> m_simulation;
 
+		// Timings are read from the main thread while the simulation thread loads and unloads the simulation. Set
+		// once the simulation is initialized and cleared before it unloads
+		std::mutex m_simulation_mutex;
+		bool m_simulation_loaded = false;
+
+		// Dedicated servers run their tasks on our own job system instead of the engines thread pool
+		std::unique_ptr<JobSystem> m_job_system;
+		std::mutex m_job_system_mutex;
+
+		std::atomic_uint64_t m_worker_share = 0;
+
+		// Shards are started and stopped from the main thread
+		std::mutex m_shards_mutex;
+		std::vector<std::unique_ptr<Shard>> m_shards;
+		int64_t m_next_shard_id = 0;
+
 		entity::Ref m_player_entity;
 		entity::Ref m_dimension_entity;
 
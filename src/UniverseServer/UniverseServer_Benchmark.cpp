@@ -0,0 +1,111 @@
+#include "UniverseServer.h"
+
+#include "Universe/UniverseModule.h"
+#include "Galaxy/GalaxyModule.h"
+#include "Spatial3D/SpatialModule.h"
+#include "Simulation/Timing.h"
+
+#include "Components.h"
+#include "Modules.h"
+#include "UniverseSimulation.h"
+
+#include <godot_cpp/classes/os.hpp>
+
+namespace voxel_game
+{
+	// How far apart the simulated galaxies of a universe are placed so that their loaders only partly overlap
+	const double k_benchmark_galaxy_spacing = 4096.0;
+
+	godot::Dictionary UniverseServer::RunBenchmark(const godot::String& path, uint64_t universe_count, uint64_t galaxy_count, uint64_t tick_count, int64_t worker_count)
+	{
+		if (m_simulation)
+		{
+			DEBUG_PRINT_ERROR("Can't run a benchmark while a simulation is loaded");
+			return godot::Dictionary();
+		}
+
+		if (universe_count == 0)
+		{
+			DEBUG_PRINT_ERROR("A benchmark needs at least one universe");
+			return godot::Dictionary();
+		}
+
+		if (worker_count < 0)
+		{
+			worker_count = std::max(godot::OS::get_singleton()->get_processor_count() - 1, 0);
+		}
+
+		// Always use our own job system so that results don't depend on the engines thread pool
+		JobSystem job_system(worker_count);
+
+		Simulation simulation;
+		simulation.job_system = &job_system;
+
+		AddSimulationModules(simulation);
+
+		SimulationInitialize(simulation);
+
+		// Every run starts from an empty save so that runs can be compared
+		SimulationSetPath(simulation, path.path_join(GenerateUUID().ToGodotString()));
+
+		std::vector<entity::Ref> universes;
+		std::vector<entity::Ref> galaxies;
+
+		for (uint64_t i = 0; i < universe_count; i++)
+		{
+			universes.push_back(universe::CreateUniverse(simulation, GenerateUUID()));
+		}
+
+		// The universe worlds are created when the universes load
+		SimulationUpdate(simulation);
+
+		for (uint64_t i = 0; i < galaxy_count; i++)
+		{
+			entity::Ref galaxy_entity = galaxy::CreateSimulatedGalaxy(simulation, GenerateUUID(), spatial3d::GetEntityWorld(universes[i % universe_count]));
+
+			galaxy_entity->*&CPosition::position = godot::Vector3((i / universe_count) * k_benchmark_galaxy_spacing, 0, 0);
+
+			galaxies.push_back(galaxy_entity);
+		}
+
+		std::vector<int64_t> tick_durations;
+		tick_durations.reserve(tick_count);
+
+		for (uint64_t i = 0; i < tick_count; i++)
+		{
+			int64_t begin = simulation::GetTimingNow();
+
+			SimulationUpdate(simulation);
+
+			tick_durations.push_back(simulation::GetTimingNow() - begin);
+		}
+
+		godot::Dictionary results;
+
+		results["universes"] = int64_t(universe_count);
+		results["galaxies"] = int64_t(galaxy_count);
+		results["workers"] = worker_count;
+		results["entities"] = int64_t(simulation.entity_factory.GetCount());
+		results["spatial_worlds"] = int64_t(simulation.spatial_worlds.size());
+		results["spatial_scales"] = int64_t(simulation.spatial_scales.size());
+
+		int64_t total_duration = 0;
+		for (int64_t duration : tick_durations)
+		{
+			total_duration += duration;
+		}
+
+		results["seconds"] = total_duration / 1e9;
+		results["ticks"] = simulation::GetPercentiles(tick_durations);
+		results["timings"] = simulation::GetTimingStats(simulation);
+
+		SimulationUnload(simulation);
+
+		galaxies.clear();
+		universes.clear();
+
+		SimulationUninitialize(simulation);
+
+		return results;
+	}
+}
@@ -0,0 +1,207 @@
+#include "UniverseServer.h"
+
+#include "Universe/UniverseModule.h"
+#include "Galaxy/GalaxyModule.h"
+#include "Spatial3D/SpatialModule.h"
+#include "Simulation/Timing.h"
+
+#include "Modules.h"
+#include "UniverseSimulation.h"
+
+#include <godot_cpp/classes/os.hpp>
+
+#include <algorithm>
+
+namespace voxel_game
+{
+	struct UniverseServer::Shard
+	{
+		int64_t id;
+		std::unique_ptr<Simulation> simulation;
+		std::thread thread;
+		std::atomic_bool running = true;
+
+		// Set once the simulation is initialized so that its timings can be read
+		std::atomic_bool loaded = false;
+
+		// How many times the shard fell too far behind and had to drop ticks
+		std::atomic_uint64_t overload_count = 0;
+	};
+
+	JobSystem& UniverseServer::GetJobSystem()
+	{
+		std::lock_guard lock(m_job_system_mutex);
+
+		if (!m_job_system)
+		{
+			m_job_system = std::make_unique<JobSystem>(std::max(godot::OS::get_singleton()->get_processor_count() - 1, 0));
+		}
+
+		return *m_job_system;
+	}
+
+	int64_t UniverseServer::StartShard(const godot::String& path, uint64_t worker_share)
+	{
+		std::unique_ptr<Shard> shard = std::make_unique<Shard>();
+
+		shard->simulation = std::make_unique<Simulation>();
+		shard->simulation->job_system = &GetJobSystem();
+		shard->simulation->worker_share = std::min<uint64_t>(worker_share, UINT8_MAX);
+
+		AddSimulationModules(*shard->simulation);
+
+		std::lock_guard lock(m_shards_mutex);
+
+		shard->id = m_next_shard_id++;
+		shard->thread = std::thread(&UniverseServer::RunShard, this, std::ref(*shard), path);
+
+		m_shards.push_back(std::move(shard));
+
+		return m_shards.back()->id;
+	}
+
+	void UniverseServer::StopShard(int64_t shard_id)
+	{
+		std::unique_ptr<Shard> shard;
+
+		{
+			std::lock_guard lock(m_shards_mutex);
+
+			auto it = std::find_if(m_shards.begin(), m_shards.end(), [shard_id](const std::unique_ptr<Shard>& shard)
+			{
+				return shard->id == shard_id;
+			});
+
+			if (it == m_shards.end())
+			{
+				DEBUG_PRINT_ERROR(godot::vformat("There is no shard with the id %d", shard_id));
+				return;
+			}
+
+			shard = std::move(*it);
+			m_shards.erase(it);
+		}
+
+		// Join outside of the lock as the shard may take a while to save and unload
+		shard->running.store(false, std::memory_order_release);
+		shard->thread.join();
+	}
+
+	void UniverseServer::StopAllShards()
+	{
+		std::vector<std::unique_ptr<Shard>> shards;
+
+		{
+			std::lock_guard lock(m_shards_mutex);
+			shards = std::move(m_shards);
+			m_shards.clear();
+		}
+
+		for (std::unique_ptr<Shard>& shard : shards)
+		{
+			shard->running.store(false, std::memory_order_release);
+		}
+
+		for (std::unique_ptr<Shard>& shard : shards)
+		{
+			shard->thread.join();
+		}
+	}
+
+	godot::PackedInt64Array UniverseServer::GetShards()
+	{
+		std::lock_guard lock(m_shards_mutex);
+
+		godot::PackedInt64Array shard_ids;
+
+		for (const std::unique_ptr<Shard>& shard : m_shards)
+		{
+			shard_ids.push_back(shard->id);
+		}
+
+		return shard_ids;
+	}
+
+	godot::Dictionary UniverseServer::GetShardTimingStats(int64_t shard_id)
+	{
+		// A shard only unloads after it has been removed so holding the lock keeps its contexts alive
+		std::lock_guard lock(m_shards_mutex);
+
+		for (const std::unique_ptr<Shard>& shard : m_shards)
+		{
+			if (shard->id == shard_id && shard->loaded.load(std::memory_order_acquire))
+			{
+				godot::Dictionary stats = simulation::GetTimingStats(*shard->simulation);
+
+				stats["overload_count"] = shard->overload_count.load(std::memory_order_relaxed);
+
+				return stats;
+			}
+		}
+
+		return godot::Dictionary();
+	}
+
+	void UniverseServer::SetWorkerShare(uint64_t worker_share)
+	{
+		m_worker_share.store(worker_share, std::memory_order_relaxed);
+	}
+
+	uint64_t UniverseServer::GetWorkerShare()
+	{
+		return m_worker_share.load(std::memory_order_relaxed);
+	}
+
+	// The simulation of a shard lives entirely on its thread, only its timings are read from other threads
+	void UniverseServer::RunShard(Shard& shard, const godot::String& path)
+	{
+		Simulation& simulation = *shard.simulation;
+
+		SimulationInitialize(simulation);
+
+		SimulationSetPath(simulation, path);
+
+		entity::Ref universe_entity = universe::CreateUniverse(simulation, GenerateUUID());
+
+		// The universe world is created when the universe loads
+		SimulationUpdate(simulation);
+
+		entity::Ref galaxy_entity = galaxy::CreateSimulatedGalaxy(simulation, GenerateUUID(), spatial3d::GetEntityWorld(universe_entity));
+
+		shard.loaded.store(true, std::memory_order_release);
+
+		// Shards tick at the same rate as the main simulation and are paced the same way
+		TickPacer pacer;
+
+		while (shard.running.load(std::memory_order_acquire))
+		{
+			Clock::time_point wait_until;
+
+			if (!pacer.Begin(GetTickRate(), wait_until))
+			{
+				std::this_thread::sleep_until(wait_until);
+				continue;
+			}
+
+			do
+			{
+				SimulationUpdate(simulation);
+			}
+			while (pacer.Next() && shard.running.load(std::memory_order_acquire));
+
+			if (uint64_t dropped_ticks = pacer.DropMissedTicks())
+			{
+				shard.overload_count.fetch_add(1, std::memory_order_relaxed);
+
+				DEBUG_PRINT_WARN(godot::vformat("Shard %d fell behind and dropped %d ticks", shard.id, dropped_ticks));
+			}
+		}
+
+		SimulationUnload(simulation);
+
+		galaxy_entity = entity::Ref();
+		universe_entity = entity::Ref();
+
+		SimulationUninitialize(simulation);
+	}
+}
\ No newline at end of file
@@ -20,8 +20,38 @@
 
 #include <godot_cpp/classes/worker_thread_pool.hpp>
 
+#include <array>
+#include <bit>
+#include <optional>
+
 namespace voxel_game
 {
+	// The most jobs a frame can schedule. Their dependencies are kept in 64 bit sets
+	const size_t k_max_frame_jobs = 64;
+
+	// The most entities updated by one task element
+	const uint32_t k_entity_batch_size = 64;
+
+	// Jobs are named after the resource they write for timings
+	const char* const k_resource_names[] =
+	{
+		"UniverseWorlds",
+		"UniverseScales",
+		"GalaxyWorlds",
+		"GalaxyScales",
+		"StarSystemWorlds",
+		"StarSystemScales",
+		"PlanetWorlds",
+		"PlanetScales",
+		"SpaceStationWorlds",
+		"SpaceStationScales",
+		"SpaceShipWorlds",
+		"SpaceShipScales",
+		"VehicleWorlds",
+		"VehicleScales",
+		"Entities",
+	};
+
 	simulation::ConfigDefaults GetConfigDefaults()
 	{
 		return
@@ -92,9 +122,87 @@ namespace voxel_game
 	{
 		TaskData* taskdata = reinterpret_cast<TaskData*>(userdata);
 
+		simulation::BindContext(taskdata->simulation);
+
+		simulation::ScopedTiming timing(*simulation::GetContext().timings, simulation::k_task_timing_name, taskdata->simulation.context_epoch);
+
 		taskdata->callback(taskdata->simulation, element);
 	}
 
+	uint64_t GodotTaskStart(Simulation& simulation, TaskData& task_data)
+	{
+		return godot::WorkerThreadPool::get_singleton()->add_native_group_task(
+			&TaskCallback,
+			&task_data,
+			task_data.count,
+			simulation.processor_count,
+			simulation.high_priority);
+	}
+
+	bool GodotTaskIsDone(Simulation& simulation, uint64_t id)
+	{
+		return godot::WorkerThreadPool::get_singleton()->is_group_task_completed(id);
+	}
+
+	void GodotTaskWait(Simulation& simulation, uint64_t id)
+	{
+		godot::WorkerThreadPool::get_singleton()->wait_for_group_task_completion(id);
+	}
+
+	const TaskBackend godot_task_backend =
+	{
+		&GodotTaskStart,
+		&GodotTaskIsDone,
+		&GodotTaskWait
+	};
+
+	// Runs a range of tasks from the simulations share of the job system. Each slot of the share has its own context
+	void JobSystemTaskCallback(void* userdata, size_t begin, size_t end, size_t slot)
+	{
+		TaskData* taskdata = reinterpret_cast<TaskData*>(userdata);
+
+		simulation::SetContext(taskdata->simulation.thread_contexts[slot]);
+
+		simulation::ScopedTiming timing(*simulation::GetContext().timings, simulation::k_task_timing_name, taskdata->simulation.context_epoch);
+
+		for (size_t index = begin; index < end; index++)
+		{
+			taskdata->callback(taskdata->simulation, index);
+		}
+	}
+
+	uint64_t JobSystemTaskStart(Simulation& simulation, TaskData& task_data)
+	{
+		DEBUG_ASSERT(simulation.job_share != nullptr, "The job system backend needs a job share");
+
+		JobShare::Batch* batch = new JobShare::Batch(&JobSystemTaskCallback, &task_data, task_data.count);
+
+		simulation.job_share->Start(*batch);
+
+		return reinterpret_cast<uint64_t>(batch);
+	}
+
+	bool JobSystemTaskIsDone(Simulation& simulation, uint64_t id)
+	{
+		return simulation.job_share->IsDone(*reinterpret_cast<JobShare::Batch*>(id));
+	}
+
+	void JobSystemTaskWait(Simulation& simulation, uint64_t id)
+	{
+		JobShare::Batch* batch = reinterpret_cast<JobShare::Batch*>(id);
+
+		simulation.job_share->Wait(*batch);
+
+		delete batch;
+	}
+
+	const TaskBackend job_system_task_backend =
+	{
+		&JobSystemTaskStart,
+		&JobSystemTaskIsDone,
+		&JobSystemTaskWait
+	};
+
 	// Run a single task group and wait for it after
 	void SimulationDoTasks(Simulation& simulation, TaskData& task_data)
 	{
@@ -109,16 +217,9 @@ namespace voxel_game
 		{
 			simulation.thread_mode = true;
 
-			godot::WorkerThreadPool* thread_pool = godot::WorkerThreadPool::get_singleton();
+			uint64_t id = simulation.task_backend->start(simulation, task_data);
 
-			uint64_t id = thread_pool->add_native_group_task(
-				&TaskCallback,
-				&task_data,
-				task_data.count,
-				simulation.processor_count,
-				simulation.high_priority);
-
-			thread_pool->wait_for_group_task_completion(id);
+			simulation.task_backend->wait(simulation, id);
 
 			simulation.thread_mode = false;
 		}
@@ -142,32 +243,150 @@ namespace voxel_game
 		{
 			simulation.thread_mode = true;
 
-			godot::WorkerThreadPool* thread_pool = godot::WorkerThreadPool::get_singleton();
-
 			GrowingSmallVector<uint64_t, 16> ids;
 			ids.reserve(task_data.Size());
 
 			for (TaskData& data : task_data)
 			{
-				uint64_t id = thread_pool->add_native_group_task(
-					&TaskCallback,
-					&data,
-					data.count,
-					simulation.processor_count,
-					simulation.high_priority);
-
-				ids.push_back(id);
+				ids.push_back(simulation.task_backend->start(simulation, data));
 			}
 
 			for (uint64_t id : ids)
 			{
-				thread_pool->wait_for_group_task_completion(id);
+				simulation.task_backend->wait(simulation, id);
 			}
 
 			simulation.thread_mode = false;
 		}
 	}
 
+	void ScheduleAddJob(FrameSchedule& schedule, const char* name, const TaskData& task_data, ResourceSet reads, ResourceSet writes)
+	{
+		schedule.jobs.push_back({ name, task_data, reads, writes });
+	}
+
+	// Run the jobs of a frame. Each job starts as soon as the earlier jobs it conflicts with are done
+	void SimulationDoSchedule(Simulation& simulation, FrameSchedule& schedule)
+	{
+		std::vector<Job>& jobs = schedule.jobs;
+
+		// Job spans go to the main thread context from when the job starts to when the main thread sees it finish
+		simulation::TimingRing& timings = *simulation::GetContext().timings;
+
+		// Jobs were added in an order that respects their dependencies so run them in that order when singlethreaded
+		if (simulation.processor_count == 0)
+		{
+			for (Job& job : jobs)
+			{
+				simulation::ScopedTiming timing(timings, job.name, simulation.context_epoch);
+
+				SimulationDoTasks(simulation, job.task);
+			}
+
+			return;
+		}
+
+		CRASH_COND_MSG(jobs.size() > k_max_frame_jobs, "Too many jobs were scheduled in a frame");
+
+		// Build the graph where an earlier job that conflicts with a later one has to finish first. A frame only has a
+		// handful of jobs so the graph is kept in bit sets on the stack
+		std::array<uint64_t, k_max_frame_jobs> dependents = {};
+		std::array<uint32_t, k_max_frame_jobs> dependency_counts = {};
+		std::array<int64_t, k_max_frame_jobs> job_begins = {};
+
+		uint64_t ready = 0;
+
+		for (size_t later = 0; later < jobs.size(); later++)
+		{
+			for (size_t earlier = 0; earlier < later; earlier++)
+			{
+				if ((jobs[earlier].writes & (jobs[later].reads | jobs[later].writes)) || (jobs[earlier].reads & jobs[later].writes))
+				{
+					dependents[earlier] |= uint64_t(1) << later;
+					dependency_counts[later]++;
+				}
+			}
+
+			if (dependency_counts[later] == 0)
+			{
+				ready |= uint64_t(1) << later;
+			}
+		}
+
+		simulation.thread_mode = true;
+
+		// Pairs of job index and group task id
+		GrowingSmallVector<std::pair<size_t, uint64_t>, 16> running;
+
+		size_t finished = 0;
+
+		auto finish_job = [&](size_t index)
+		{
+			timings.Push({ jobs[index].name, simulation.context_epoch, job_begins[index], simulation::GetTimingNow() });
+
+			for (uint64_t remaining = dependents[index]; remaining != 0; remaining &= remaining - 1)
+			{
+				size_t dependent = std::countr_zero(remaining);
+
+				if (--dependency_counts[dependent] == 0)
+				{
+					ready |= uint64_t(1) << dependent;
+				}
+			}
+
+			finished++;
+		};
+
+		while (finished < jobs.size())
+		{
+			while (ready != 0)
+			{
+				size_t index = std::countr_zero(ready);
+				ready &= ready - 1;
+
+				TaskData& task_data = jobs[index].task;
+
+				job_begins[index] = simulation::GetTimingNow();
+
+				// Empty jobs finish right away
+				if (task_data.count == 0)
+				{
+					finish_job(index);
+					continue;
+				}
+
+				running.push_back({ index, simulation.task_backend->start(simulation, task_data) });
+			}
+
+			if (running.empty())
+			{
+				break;
+			}
+
+			// Prefer a job that is already done so its dependents can start, otherwise wait for the oldest
+			size_t wait_index = 0;
+			for (size_t i = 0; i < running.size(); i++)
+			{
+				if (simulation.task_backend->is_done(simulation, running[i].second))
+				{
+					wait_index = i;
+					break;
+				}
+			}
+
+			auto [index, id] = running[wait_index];
+			running.erase(running.begin() + wait_index);
+
+			simulation.task_backend->wait(simulation, id);
+
+			finish_job(index);
+		}
+
+		DEBUG_ASSERT(finished == jobs.size(), "All jobs in the frame should have run");
+
+		simulation.thread_mode = false;
+	}
+
 	template<SpatialTypeData Simulation::* type>
 	void SimulationWorldUpdateTask(Simulation& simulation, size_t index)
 	{
@@ -194,21 +413,84 @@ namespace voxel_game
 		}
 	}
 
+	template<SpatialTypeData Simulation::* type>
+	void SimulationScheduleSpatialType(Simulation& simulation, FrameSchedule& schedule, Resource worlds, Resource scales)
+	{
+		SpatialTypeData& type_data = simulation.*type;
+
+		ScheduleAddJob(schedule, k_resource_names[size_t(worlds)],
+			{ simulation, &SimulationWorldUpdateTask<type>, type_data.worlds.size() },
+			type_data.world_reads,
+			MakeResourceSet(worlds));
+
+		ScheduleAddJob(schedule, k_resource_names[size_t(scales)],
+			{ simulation, &SimulationScaleUpdateTask<type>, type_data.scales.size() },
+			type_data.scale_reads | MakeResourceSet(worlds),
+			MakeResourceSet(scales));
+	}
+
+	// Group the updating entities by archetype and split the groups into batches for the entity tasks
+	void SimulationBatchEntities(Simulation& simulation)
+	{
+		std::vector<entity::WRef>& order = simulation.entity_update_order;
+		std::vector<EntityBatch>& batches = simulation.entity_update_batches;
+
+		order.clear();
+		batches.clear();
+
+		// Entities with no task callbacks don't need to be updated at all
+		for (entity::WRef entity : simulation.updating_entities)
+		{
+			if (entity.GetType()->HasCallbacks(PolyEvent::TaskUpdate))
+			{
+				order.push_back(entity);
+			}
+		}
+
+		std::sort(order.begin(), order.end(), [](entity::WRef a, entity::WRef b)
+		{
+			return a.GetType() < b.GetType();
+		});
+
+		uint32_t begin = 0;
+
+		for (uint32_t index = 1; index <= order.size(); index++)
+		{
+			if (index == order.size() || index - begin == k_entity_batch_size || order[index].GetType() != order[begin].GetType())
+			{
+				batches.push_back({ begin, index - begin });
+				begin = index;
+			}
+		}
+	}
+
 	void SimulationEntityUpdateTask(Simulation& simulation, size_t index)
 	{
-		entity::WRef entity = simulation.updating_entities[index];
+		EntityBatch batch = simulation.entity_update_batches[index];
+
+		Span<entity::WRef> entities(simulation.entity_update_order.data() + batch.begin, batch.count);
+
+#if defined(DEBUG_THREAD_CHECK)
+		// Keep a write check on every entity in the batch for the whole update
+		std::optional<DebugThreadChecker> thread_checks[k_entity_batch_size];
 
-		DEBUG_THREAD_CHECK_WRITE(entity.Data());
+		for (size_t i = 0; i < entities.Size(); i++)
+		{
+			thread_checks[i].emplace(entities[i].Data(), true);
+		}
+#endif
 
-		simulation.entity_factory.DoEvent(PolyEvent::TaskUpdate, entity);
+		simulation.entity_factory.DoBatchEvent(PolyEvent::TaskUpdate, entities);
 	}
 	
 	void SimulationWorkerUpdateTask(Simulation& simulation, size_t index)
 	{
-		simulation::SetContext(simulation.thread_contexts[index]);
+		simulation::TimingRing& timings = *simulation::GetContext().timings;
 
 		for (Module& module : simulation.modules)
 		{
+			simulation::ScopedTiming timing(timings, module.name, simulation.context_epoch);
+
 			module.worker_update(simulation, index);
 		}
 	}
@@ -281,71 +563,90 @@ namespace voxel_game
 	{
 		DEBUG_THREAD_CHECK_WRITE(&simulation); // Should be called singlethreaded
 
-		// Do parallel spatial world updates
-		TaskData world_tasks[7] = {
-			{ simulation, &SimulationWorldUpdateTask<&Simulation::universe_type>, simulation.universe_type.worlds.size() },
-			{ simulation, &SimulationWorldUpdateTask<&Simulation::galaxy_type>, simulation.galaxy_type.worlds.size() },
-			{ simulation, &SimulationWorldUpdateTask<&Simulation::star_system_type>, simulation.star_system_type.worlds.size() },
-			{ simulation, &SimulationWorldUpdateTask<&Simulation::planet_type>, simulation.planet_type.worlds.size() },
-			{ simulation, &SimulationWorldUpdateTask<&Simulation::space_station_type>, simulation.space_station_type.worlds.size() },
-			{ simulation, &SimulationWorldUpdateTask<&Simulation::space_ship_type>, simulation.space_ship_type.worlds.size() },
-			{ simulation, &SimulationWorldUpdateTask<&Simulation::vehicle_type>, simulation.vehicle_type.worlds.size() },
-		};
+		simulation::BeginFrameContexts(simulation);
 
-		SimulationDoMultitasks(simulation, world_tasks);
-
-		// Do parallel spatial scale updates
-		TaskData scale_tasks[7] = {
-			{ simulation, &SimulationScaleUpdateTask<&Simulation::universe_type>, simulation.universe_type.scales.size() },
-			{ simulation, &SimulationScaleUpdateTask<&Simulation::galaxy_type>, simulation.galaxy_type.scales.size() },
-			{ simulation, &SimulationScaleUpdateTask<&Simulation::star_system_type>, simulation.star_system_type.scales.size() },
-			{ simulation, &SimulationScaleUpdateTask<&Simulation::planet_type>, simulation.planet_type.scales.size() },
-			{ simulation, &SimulationScaleUpdateTask<&Simulation::space_station_type>, simulation.space_station_type.scales.size() },
-			{ simulation, &SimulationScaleUpdateTask<&Simulation::space_ship_type>, simulation.space_ship_type.scales.size() },
-			{ simulation, &SimulationScaleUpdateTask<&Simulation::vehicle_type>, simulation.vehicle_type.scales.size() },
-		};
+		simulation::TimingRing& timings = *simulation::GetContext().timings;
+
+		simulation::ScopedTiming frame_timing(timings, simulation::k_frame_timing_name, simulation.context_epoch);
+
+		// The schedule is kept on the simulation so its jobs don't have to be allocated every frame
+		FrameSchedule& schedule = simulation.schedule;
+		schedule.jobs.clear();
 
-		SimulationDoMultitasks(simulation, scale_tasks);
+		// Spatial world and scale updates. Scales wait for the worlds their type declares reading
+		SimulationScheduleSpatialType<&Simulation::universe_type>(simulation, schedule, Resource::UniverseWorlds, Resource::UniverseScales);
+		SimulationScheduleSpatialType<&Simulation::galaxy_type>(simulation, schedule, Resource::GalaxyWorlds, Resource::GalaxyScales);
+		SimulationScheduleSpatialType<&Simulation::star_system_type>(simulation, schedule, Resource::StarSystemWorlds, Resource::StarSystemScales);
+		SimulationScheduleSpatialType<&Simulation::planet_type>(simulation, schedule, Resource::PlanetWorlds, Resource::PlanetScales);
+		SimulationScheduleSpatialType<&Simulation::space_station_type>(simulation, schedule, Resource::SpaceStationWorlds, Resource::SpaceStationScales);
+		SimulationScheduleSpatialType<&Simulation::space_ship_type>(simulation, schedule, Resource::SpaceShipWorlds, Resource::SpaceShipScales);
+		SimulationScheduleSpatialType<&Simulation::vehicle_type>(simulation, schedule, Resource::VehicleWorlds, Resource::VehicleScales);
 
-		// Run all entities in parallel doing entity specific code
-		TaskData entity_task = { simulation, &SimulationEntityUpdateTask, simulation.updating_entities.size() };
+		// Run batches of entities in parallel doing entity specific code after everything spatial is done
+		SimulationBatchEntities(simulation);
 
-		SimulationDoTasks(simulation, entity_task);
+		ScheduleAddJob(schedule, k_resource_names[size_t(Resource::Entities)], { simulation, &SimulationEntityUpdateTask, simulation.entity_update_batches.size() }, k_all_resources, MakeResourceSet(Resource::Entities));
+
+		for (Module& module : simulation.modules)
+		{
+			if (module.schedule)
+			{
+				module.schedule(simulation, schedule);
+			}
+		}
 
-		// Run worker tasks in parallel for systems that need them. There is usually one per CPU core
-		TaskData worker_task{ simulation, &SimulationWorkerUpdateTask, simulation.worker_count };
+		// Run worker tasks in parallel for systems that need them. There is usually one per CPU core.
+		// Worker updates don't declare what they use so they run after everything else
+		ScheduleAddJob(schedule, "WorkerUpdate", { simulation, &SimulationWorkerUpdateTask, simulation.worker_count }, k_all_resources, k_all_resources);
 
-		SimulationDoTasks(simulation, worker_task);
+		SimulationDoSchedule(simulation, schedule);
 
 		// Do singlethreaded update
 		for (Module& module : simulation.modules)
 		{
+			simulation::ScopedTiming timing(timings, module.name, simulation.context_epoch);
+
 			module.update(simulation);
 		}
 
-		for (ThreadContext& context : simulation.thread_contexts)
 		{
-			for (entity::WRef entity : context.load_commands)
+			simulation::ScopedTiming timing(timings, "LoadEvents", simulation.context_epoch);
+
+			for (ThreadContext& context : simulation.thread_contexts)
 			{
-				simulation.entity_factory.DoEvent(PolyEvent::BeginLoad, entity);
+				for (entity::WRef entity : context.load_commands)
+				{
+					simulation.entity_factory.DoEvent(PolyEvent::BeginLoad, entity);
+				}
+
+				context.load_commands.clear();
+
+				for (entity::WRef entity : context.unload_commands)
+				{
+					simulation.entity_factory.DoEvent(PolyEvent::BeginUnload, entity);
+				}
+
+				context.unload_commands.clear();
 			}
+		}
 
-			context.load_commands.clear();
+		{
+			simulation::ScopedTiming timing(timings, "MainUpdate", simulation.context_epoch);
 
-			for (entity::WRef entity : context.unload_commands)
+			for (entity::WRef entity : simulation.updating_entities)
 			{
-				simulation.entity_factory.DoEvent(PolyEvent::BeginUnload, entity);
+				simulation.entity_factory.DoEvent(PolyEvent::MainUpdate, entity);
 			}
-
-			context.unload_commands.clear();
 		}
 
-		for (entity::WRef entity : simulation.updating_entities)
 		{
-			simulation.entity_factory.DoEvent(PolyEvent::MainUpdate, entity);
+			simulation::ScopedTiming timing(timings, "Cleanup", simulation.context_epoch);
+
+			simulation.entity_factory.Cleanup();
 		}
 
-		simulation.entity_factory.Cleanup();
+		// Components written from here on belong to the next frame
+		simulation.entity_factory.AdvanceChangeTick();
 	}
 
 	void SimulationSetPath(Simulation& simulation, const godot::String& path)
@@ -361,7 +662,6 @@ namespace voxel_game
 		simulation.vehicle_type.path = simulation.path.path_join("Vehicles");
 
 		simulation::InitializeConfig(simulation.config, simulation.path.path_join("config.json"), GetConfigDefaults());
-		simulation.last_config_save = simulation.frame_start_time;
 	}
 
 	entity::Ref SimulationCreateEntity(Simulation& simulation, UUID id, entity::TypeID types)
@@ -373,6 +673,21 @@ namespace voxel_game
 		return entity;
 	}
 
+	// Create many entities at once as copies of a prefab. Only the entities that didn't exist yet are loaded
+	void SimulationInstantiateEntities(Simulation& simulation, const entity::Prefab& prefab, Span<UUID> ids, std::vector<entity::Ref>& entities_out)
+	{
+		std::vector<entity::WRef> created;
+
+		simulation.entity_factory.Instantiate(prefab, ids, entities_out, &created);
+
+		ThreadContext& context = simulation::GetContext();
+
+		for (entity::WRef entity : created)
+		{
+			context.load_commands.push_back(entity::Ref(entity));
+		}
+	}
+
 	void SimulationUnloadEntity(Simulation& simulation, entity::WRef entity)
 	{
 		simulation::GetContext().unload_commands.push_back(entity::Ref(entity));
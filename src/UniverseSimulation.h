@@ -12,9 +12,14 @@
 #include "Player/Player.h"
 
 #include "Simulation/Config.h"
+#include "Simulation/Timing.h"
 
 #include "Commands/TypedCommandBuffer.h"
 
+#include "Util/JobSystem.h"
+#include "Util/JobShare.h"
+#include "Util/FrameArena.h"
+
 #include <godot_cpp/variant/string.hpp>
 
 #include <godot_cpp/classes/x509_certificate.hpp>
@@ -35,6 +40,79 @@ namespace voxel_game
 		size_t count;
 	};
 
+	// Runs task groups on worker threads. Start returns an id that is later waited on exactly once
+	struct TaskBackend
+	{
+		uint64_t(*start)(Simulation&, TaskData&);
+		bool(*is_done)(Simulation&, uint64_t);
+		void(*wait)(Simulation&, uint64_t);
+	};
+
+	extern const TaskBackend godot_task_backend;
+	extern const TaskBackend job_system_task_backend;
+
+	// Data that jobs in a frame can read or write. Each spatial type has its worlds and scales as separate resources
+	enum class Resource : uint8_t
+	{
+		UniverseWorlds,
+		UniverseScales,
+		GalaxyWorlds,
+		GalaxyScales,
+		StarSystemWorlds,
+		StarSystemScales,
+		PlanetWorlds,
+		PlanetScales,
+		SpaceStationWorlds,
+		SpaceStationScales,
+		SpaceShipWorlds,
+		SpaceShipScales,
+		VehicleWorlds,
+		VehicleScales,
+		Entities,
+	};
+
+	using ResourceSet = uint64_t;
+
+	constexpr ResourceSet k_all_resources = ~ResourceSet(0);
+
+	constexpr ResourceSet k_all_worlds =
+		ResourceSet(1) << to_underlying(Resource::UniverseWorlds) |
+		ResourceSet(1) << to_underlying(Resource::GalaxyWorlds) |
+		ResourceSet(1) << to_underlying(Resource::StarSystemWorlds) |
+		ResourceSet(1) << to_underlying(Resource::PlanetWorlds) |
+		ResourceSet(1) << to_underlying(Resource::SpaceStationWorlds) |
+		ResourceSet(1) << to_underlying(Resource::SpaceShipWorlds) |
+		ResourceSet(1) << to_underlying(Resource::VehicleWorlds);
+
+	template<class... Resources>
+	constexpr ResourceSet MakeResourceSet(Resources... resources)
+	{
+		return ((ResourceSet(1) << to_underlying(resources)) | ... | ResourceSet(0));
+	}
+
+	// A task group in a frame along with the resources its tasks use
+	struct Job
+	{
+		const char* name;
+		TaskData task;
+		ResourceSet reads;
+		ResourceSet writes;
+	};
+
+	// The jobs of a single frame. A job waits for the jobs added before it that write what it uses or use what it writes
+	// and runs at the same time as everything else
+	struct FrameSchedule
+	{
+		std::vector<Job> jobs;
+	};
+
+	// A run of updating entities that share an archetype and are updated together by one task
+	struct EntityBatch
+	{
+		uint32_t begin;
+		uint32_t count;
+	};
+
 	// Per thread data
 	struct ThreadContext
 	{
@@ -46,6 +124,12 @@ namespace voxel_game
 		TCommandBuffer<RS> commands;
 
 		rendering::Allocator allocator;
+
+		// Transient allocations that are freed at the start of every frame
+		FrameArena arena;
+
+		// The latest timings of what ran with this context
+		std::unique_ptr<simulation::TimingRing> timings = std::make_unique<simulation::TimingRing>();
 	};
 
 	// Extra for spatial types
@@ -56,6 +140,11 @@ namespace voxel_game
 		std::vector<void(*)(Simulation&, spatial3d::WorldPtr)> world_updates;
 		std::vector<void(*)(Simulation&, spatial3d::ScalePtr)> scale_updates;
 
+		// What the world and scale updates read besides the worlds or scales they update. Scales always read the
+		// worlds of their own type and the loaders they load around live in those worlds
+		ResourceSet world_reads = 0;
+		ResourceSet scale_reads = 0;
+
 		// Arrays of worlds and scales of this type for tasks to reference
 		std::vector<spatial3d::WorldPtr> worlds;
 		std::vector<spatial3d::ScalePtr> scales;
@@ -71,22 +160,41 @@ namespace voxel_game
 		uint8_t processor_count = 0;
 		uint8_t worker_count = 1;
 
+		// The engines thread pool is used unless a job system is given before initializing. The job system can be
+		// shared by several simulations
+		JobSystem* job_system = nullptr;
+		std::unique_ptr<JobShare> job_share;
+
+		// How many worker threads of the job system the simulation may use at once. Zero uses all of them. The engines
+		// thread pool always uses all of its threads
+		uint8_t worker_share = 0;
+
+		const TaskBackend* task_backend = &godot_task_backend;
+
 		uint64_t frame_index = 0;
 		Clock::time_point frame_start_time;
 
 		godot::String path;
 
 		simulation::Config config;
-		Clock::time_point last_config_save;
 
+		uint64_t instance_id = 0; // Unique for every initialized simulation, used to tell which one a thread is bound to
 		std::vector<ThreadContext> thread_contexts;
+		std::atomic_uint32_t bound_context_count = 0;
+		uint64_t context_epoch = 0; // Bumped every frame so threads bind a fresh context
 
 		std::vector<Module> modules;
 
+		FrameSchedule schedule;
+
 		// Spatial
 		std::vector<spatial3d::WorldPtr> spatial_worlds;
 		std::vector<spatial3d::ScalePtr> spatial_scales;
 
+		// Worlds grouped by how deeply they are nested for updating their frames
+		std::vector<std::vector<spatial3d::WorldPtr>> world_frame_levels;
+		size_t world_frame_level = 0;
+
 		SpatialTypeData universe_type;
 		SpatialTypeData galaxy_type;
 		SpatialTypeData star_system_type;
@@ -100,6 +208,13 @@ namespace voxel_game
 
 		std::vector<entity::Ref> updating_entities;
 
+		// The updating entities grouped by archetype each frame so that tasks get batches of a single archetype
+		std::vector<entity::WRef> entity_update_order;
+		std::vector<EntityBatch> entity_update_batches;
+
+		// Every generated galaxy is instantiated from this prefab
+		std::unique_ptr<entity::Prefab> galaxy_prefab;
+
 		// Entity lists
 		std::vector<entity::WRef> universes;
 		std::vector<entity::WRef> galaxies;
@@ -123,6 +238,9 @@ namespace voxel_game
 	void SimulationDoTasks(Simulation& simulation, TaskData& task_data);
 	void SimulationDoMultitasks(Simulation& simulation, Span<TaskData> task_data);
 
+	void ScheduleAddJob(FrameSchedule& schedule, const char* name, const TaskData& task_data, ResourceSet reads, ResourceSet writes);
+	void SimulationDoSchedule(Simulation& simulation, FrameSchedule& schedule);
+
 	void SimulationInitialize(Simulation& simulation);
 	void SimulationUnload(Simulation& simulation);
 	void SimulationUninitialize(Simulation& simulation);
@@ -131,5 +249,6 @@ namespace voxel_game
 	void SimulationSetPath(Simulation& simulation, const godot::String& path);
 
 	entity::Ref SimulationCreateEntity(Simulation& simulation, UUID id, entity::TypeID types);
+	void SimulationInstantiateEntities(Simulation& simulation, const entity::Prefab& prefab, Span<UUID> ids, std::vector<entity::Ref>& entities_out);
 	void SimulationUnloadEntity(Simulation& simulation, entity::WRef entity);
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "Debug.h"
 #include "Nocopy.h"
 #include "SmallVector.h"
+#include "PerThread.h"
 #include "Util.h"
 
 #include <robin_hood/robin_hood.h>
@@ -21,10 +22,23 @@ namespace
 
 	struct ThreadObjectMap
 	{
-		tkrzw::SpinSharedMutex mutex;
+		tkrzw::SpinMutex mutex;
 		robin_hood::unordered_map<const void*, ThreadObject> objects;
+	};
+
+	// Objects are spread over many maps by their address so that threads checking
+	// different objects don't wait on each other
+	constexpr size_t k_thread_object_map_bits = 8;
+
+	std::array<AlignedData<ThreadObjectMap>, 1ull << k_thread_object_map_bits> thread_object_maps;
+
+	ThreadObjectMap& GetThreadObjectMap(const void* object)
+	{
+		// Fibonacci hashing spreads the bits of the address into the top bits we use
+		uint64_t hash = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(object)) * 0x9E3779B97F4A7C15ull;
+
+		return thread_object_maps[hash >> (64 - k_thread_object_map_bits)];
 	}
-	thread_object_map;
 
 	// Return true if the storage only contains instances of the target
 	template<class T, class Storage>
@@ -46,11 +60,13 @@ DebugThreadChecker::DebugThreadChecker(const void* object, bool write) :
 	m_object(object),
 	m_write(write)
 {
-	std::unique_lock write_lock(thread_object_map.mutex);
+	std::thread::id thread_id = std::this_thread::get_id();
 
-	ThreadObject& object_data = thread_object_map.objects[object];
+	ThreadObjectMap& thread_object_map = GetThreadObjectMap(object);
 
-	std::thread::id thread_id = std::this_thread::get_id();
+	std::lock_guard lock(thread_object_map.mutex);
+
+	ThreadObject& object_data = thread_object_map.objects[object];
 
 	if (write)
 	{
@@ -79,7 +95,11 @@ DebugThreadChecker::DebugThreadChecker(const void* object, bool write) :
 
 DebugThreadChecker::~DebugThreadChecker()
 {
-	std::unique_lock write_lock(thread_object_map.mutex);
+	std::thread::id thread_id = std::this_thread::get_id();
+
+	ThreadObjectMap& thread_object_map = GetThreadObjectMap(m_object);
+
+	std::lock_guard lock(thread_object_map.mutex);
 
 	auto it = thread_object_map.objects.find(m_object);
 
@@ -96,7 +116,7 @@ DebugThreadChecker::~DebugThreadChecker()
 	}
 	else
 	{
-		unordered_erase(object_data.read, std::this_thread::get_id());
+		unordered_erase(object_data.read, thread_id);
 	}
 
 	if (object_data.read.is_empty() && object_data.write == std::thread::id{})
@@ -1,11 +1,44 @@
 #pragma once
 
-#include <godot_cpp/core/error_macros.hpp>
-#include <godot_cpp/variant/utility_functions.hpp>
-
 #include <thread>
 
+#if defined(HEADLESS_BUILD)
+
+// Headless programs like the benchmarks run without the engine so godot's print and error functions can't be used
+#include <cstdio>
+#include <cstdlib>
+
+#define HEADLESS_PRINT(m_prefix, m_msg) std::fprintf(stderr, "%s%s (%s:%d)\n", m_prefix, m_msg, __FILE__, __LINE__)
+
+#define CRASH_NOW_MSG(m_msg) (HEADLESS_PRINT("FATAL: ", m_msg), std::abort())
+#define CRASH_COND_MSG(m_cond, m_msg) if (m_cond) { CRASH_NOW_MSG(m_msg); } else ((void)0)
+
 #if defined(DEBUG_ENABLED) || defined(TOOLS_ENABLED)
+#define DEBUG_CRASH(m_msg) CRASH_NOW_MSG(m_msg)
+#define DEBUG_ASSERT(m_cond, m_msg) CRASH_COND_MSG(!(m_cond), m_msg)
+#define DEBUG_ONLY(m_cond) m_cond
+
+#define DEBUG_PRINT_INFO(m_msg) HEADLESS_PRINT("", m_msg)
+#define DEBUG_PRINT_WARN(m_msg) HEADLESS_PRINT("WARNING: ", m_msg)
+#define DEBUG_PRINT_ERROR(m_msg) HEADLESS_PRINT("ERROR: ", m_msg)
+#else
+#define DEBUG_CRASH(m_msg)
+#define DEBUG_ASSERT(m_cond, m_msg)
+#define DEBUG_ONLY(m_cond)
+
+#define DEBUG_PRINT_INFO(m_msg)
+#define DEBUG_PRINT_WARN(m_msg)
+#define DEBUG_PRINT_ERROR(m_msg)
+#endif
+
+#define RUNTIME_PRINT_INFO(m_msg) HEADLESS_PRINT("", m_msg)
+#define RUNTIME_PRINT_WARN(m_msg) HEADLESS_PRINT("WARNING: ", m_msg)
+#define RUNTIME_PRINT_ERROR(m_msg) HEADLESS_PRINT("ERROR: ", m_msg)
+
+#elif defined(DEBUG_ENABLED) || defined(TOOLS_ENABLED)
+
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/variant/utility_functions.hpp>
 
 #define DEBUG_CRASH(m_msg) CRASH_NOW_MSG(m_msg)
 #define DEBUG_ASSERT(m_cond, m_msg) CRASH_COND_MSG(!(m_cond), m_msg)
@@ -23,6 +56,9 @@
 
 #else // DEBUG
 
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/variant/utility_functions.hpp>
+
 #define DEBUG_CRASH(m_msg)
 #define DEBUG_ASSERT(m_cond, m_msg)
 #define DEBUG_ONLY(m_cond)
@@ -0,0 +1,210 @@
+#pragma once
+
+#include "Debug.h"
+#include "Nocopy.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// A growable linear allocator for memory that only lives until the next reset, usually one frame. Allocations are
+// bumped out of large blocks and never freed individually. When a frame needed more than one block they are merged
+// into a single bigger block on reset so that frames of the same size stop touching malloc.
+// Destructors of objects made in the arena are never run.
+class FrameArena : Nocopy
+{
+	struct Block
+	{
+		std::unique_ptr<std::byte[]> data;
+		size_t size;
+	};
+
+public:
+	constexpr static size_t k_default_block_size = 64 * 1024;
+
+	FrameArena(size_t block_size = k_default_block_size) :
+		m_block_size(block_size)
+	{}
+
+	// Allocate some aligned bytes that stay valid until the next reset
+	void* Alloc(size_t size, size_t align)
+	{
+		if (m_current < m_blocks.size())
+		{
+			if (void* ptr = AllocFromBlock(m_blocks[m_current], size, align))
+			{
+				return ptr;
+			}
+		}
+
+		return AllocSlow(size, align);
+	}
+
+	// Construct an object in the arena. Its destructor won't be called
+	template<class T, class... Args>
+	T* New(Args&&... args)
+	{
+		return new (Alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	// Allocate an array of a type that will be default constructed. Their destructors won't be called
+	template<class T>
+	T* NewArray(size_t count)
+	{
+		T* ptr = static_cast<T*>(Alloc(sizeof(T) * count, alignof(T)));
+
+		std::uninitialized_default_construct_n(ptr, count);
+
+		return ptr;
+	}
+
+	// Free all allocations at once
+	void Reset()
+	{
+		m_high_water_mark = std::max(m_high_water_mark, m_used);
+
+		// Merge the blocks so that next time everything fits in the first one
+		if (m_blocks.size() > 1)
+		{
+			size_t capacity = GetCapacity();
+
+			m_blocks.clear();
+			m_blocks.push_back({ std::make_unique<std::byte[]>(capacity), capacity });
+			m_block_allocations++;
+		}
+
+		m_current = 0;
+		m_offset = 0;
+		m_used = 0;
+	}
+
+	// Bytes allocated since the last reset including alignment padding
+	size_t GetUsed() const
+	{
+		return m_used;
+	}
+
+	// The most bytes used between two resets
+	size_t GetHighWaterMark() const
+	{
+		return std::max(m_high_water_mark, m_used);
+	}
+
+	size_t GetCapacity() const
+	{
+		size_t capacity = 0;
+
+		for (const Block& block : m_blocks)
+		{
+			capacity += block.size;
+		}
+
+		return capacity;
+	}
+
+	// How many times a block had to be allocated from the heap
+	size_t GetBlockAllocationCount() const
+	{
+		return m_block_allocations;
+	}
+
+private:
+	void* AllocFromBlock(Block& block, size_t size, size_t align)
+	{
+		std::uintptr_t base = reinterpret_cast<std::uintptr_t>(block.data.get());
+		std::uintptr_t aligned = (base + m_offset + align - 1) & ~(align - 1);
+
+		size_t end = aligned - base + size;
+
+		if (end > block.size)
+		{
+			return nullptr;
+		}
+
+		m_used += end - m_offset;
+		m_offset = end;
+
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	void* AllocSlow(size_t size, size_t align)
+	{
+		// Move on to blocks left over from earlier frames before allocating a new one
+		while (m_current + 1 < m_blocks.size())
+		{
+			m_current++;
+			m_offset = 0;
+
+			if (void* ptr = AllocFromBlock(m_blocks[m_current], size, align))
+			{
+				return ptr;
+			}
+		}
+
+		size_t block_size = std::max(m_block_size, size + align);
+
+		m_blocks.push_back({ std::make_unique<std::byte[]>(block_size), block_size });
+		m_block_allocations++;
+
+		m_current = m_blocks.size() - 1;
+		m_offset = 0;
+
+		return AllocFromBlock(m_blocks[m_current], size, align);
+	}
+
+private:
+	std::vector<Block> m_blocks;
+	size_t m_current = 0;
+	size_t m_offset = 0;
+	size_t m_block_size;
+
+	// Stats
+	size_t m_used = 0;
+	size_t m_high_water_mark = 0;
+	size_t m_block_allocations = 0;
+};
+
+// An allocator for STL containers that takes its memory from a frame arena. The container must not outlive the next reset
+template<class T>
+class FrameAllocator
+{
+public:
+	using value_type = T;
+
+	FrameAllocator(FrameArena& arena) :
+		m_arena(&arena)
+	{}
+
+	template<class U>
+	FrameAllocator(const FrameAllocator<U>& other) :
+		m_arena(other.GetArena())
+	{}
+
+	T* allocate(size_t count)
+	{
+		return static_cast<T*>(m_arena->Alloc(sizeof(T) * count, alignof(T)));
+	}
+
+	// Memory is only given back when the arena is reset
+	void deallocate(T* ptr, size_t count)
+	{}
+
+	FrameArena* GetArena() const
+	{
+		return m_arena;
+	}
+
+	template<class U>
+	bool operator==(const FrameAllocator<U>& other) const
+	{
+		return m_arena == other.GetArena();
+	}
+
+private:
+	FrameArena* m_arena;
+};
+
+template<class T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include "JobShare.h"
+#include "Debug.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace
+{
+	// How many chunks each slot should get from a batch when no grain is given
+	const size_t k_chunks_per_slot = 8;
+}
+
+JobShare::Batch::Batch(Function function, void* userdata, size_t count, size_t grain) :
+	m_function(function),
+	m_userdata(userdata),
+	m_count(count),
+	m_grain(grain),
+	m_remaining(count)
+{}
+
+JobShare::JobShare(JobSystem& job_system, size_t width) :
+	m_job_system(job_system),
+	m_width(std::min(width, k_max_width))
+{
+	// Slot 0 is never free as it belongs to the waiting thread
+	m_free_slots.store(((uint64_t(1) << m_width) - 1) << 1, std::memory_order_relaxed);
+}
+
+JobShare::~JobShare()
+{
+	DEBUG_ASSERT(m_batches.empty(), "All batches should be waited on before the share is destroyed");
+
+	m_job_system.Wait(m_runners);
+}
+
+size_t JobShare::GetWidth() const
+{
+	return m_width;
+}
+
+void JobShare::Start(Batch& batch)
+{
+	if (batch.m_count == 0)
+	{
+		return;
+	}
+
+	if (batch.m_grain == 0)
+	{
+		batch.m_grain = std::max<size_t>(1, batch.m_count / ((m_width + 1) * k_chunks_per_slot));
+	}
+
+	{
+		std::lock_guard lock(m_mutex);
+		m_batches.push_back(&batch);
+	}
+
+	StartRunners((batch.m_count + batch.m_grain - 1) / batch.m_grain);
+}
+
+bool JobShare::IsDone(const Batch& batch) const
+{
+	return batch.m_remaining.load(std::memory_order_acquire) == 0;
+}
+
+void JobShare::Wait(Batch& batch)
+{
+	Batch* claimed;
+	size_t begin;
+	size_t end;
+
+	while (ClaimChunk(&batch, claimed, begin, end))
+	{
+		RunChunk(batch, begin, end, 0);
+	}
+
+	// Runners may still be running the last chunks
+	while (!IsDone(batch))
+	{
+		std::this_thread::yield();
+	}
+
+	// The batch may not have been removed yet if we took the last chunk
+	std::lock_guard lock(m_mutex);
+
+	auto it = std::find(m_batches.begin(), m_batches.end(), &batch);
+
+	if (it != m_batches.end())
+	{
+		m_batches.erase(it);
+	}
+}
+
+void JobShare::RunnerTask(void* userdata, size_t, size_t)
+{
+	JobShare* share = static_cast<JobShare*>(userdata);
+
+	// There is always a free slot for each runner
+	uint64_t free_slots = share->m_free_slots.load(std::memory_order_relaxed);
+	size_t slot;
+
+	do
+	{
+		DEBUG_ASSERT(free_slots != 0, "A runner started without a free slot");
+
+		slot = std::countr_zero(free_slots);
+	}
+	while (!share->m_free_slots.compare_exchange_weak(free_slots, free_slots & ~(uint64_t(1) << slot), std::memory_order_acquire, std::memory_order_relaxed));
+
+	Batch* batch;
+	size_t begin;
+	size_t end;
+
+	while (share->ClaimChunk(nullptr, batch, begin, end))
+	{
+		share->RunChunk(*batch, begin, end, slot);
+	}
+
+	share->m_free_slots.fetch_or(uint64_t(1) << slot, std::memory_order_release);
+	share->m_runner_count.fetch_sub(1, std::memory_order_acq_rel);
+
+	// A batch started after we ran out of work may not have seen us leave
+	if (share->HasWork())
+	{
+		share->StartRunners(1);
+	}
+}
+
+void JobShare::StartRunners(size_t chunks)
+{
+	size_t wanted = std::min(m_width, chunks);
+	size_t count = m_runner_count.load(std::memory_order_relaxed);
+
+	while (count < wanted)
+	{
+		if (m_runner_count.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+		{
+			m_job_system.Run(m_runners, &JobShare::RunnerTask, this);
+			count++;
+		}
+	}
+}
+
+bool JobShare::ClaimChunk(Batch* only, Batch*& batch_out, size_t& begin_out, size_t& end_out)
+{
+	std::lock_guard lock(m_mutex);
+
+	if (only)
+	{
+		if (only->m_next >= only->m_count)
+		{
+			return false;
+		}
+
+		batch_out = only;
+	}
+	else
+	{
+		// Batches that have handed out all of their chunks are done with as far as runners are concerned
+		while (!m_batches.empty() && m_batches.front()->m_next >= m_batches.front()->m_count)
+		{
+			m_batches.pop_front();
+		}
+
+		if (m_batches.empty())
+		{
+			return false;
+		}
+
+		batch_out = m_batches.front();
+	}
+
+	begin_out = batch_out->m_next;
+	end_out = std::min(begin_out + batch_out->m_grain, batch_out->m_count);
+
+	batch_out->m_next = end_out;
+
+	return true;
+}
+
+void JobShare::RunChunk(Batch& batch, size_t begin, size_t end, size_t slot)
+{
+	batch.m_function(batch.m_userdata, begin, end, slot);
+
+	// The batch may be destroyed by its waiter as soon as this reaches zero
+	batch.m_remaining.fetch_sub(end - begin, std::memory_order_release);
+}
+
+bool JobShare::HasWork()
+{
+	std::lock_guard lock(m_mutex);
+
+	for (Batch* batch : m_batches)
+	{
+		if (batch->m_next < batch->m_count)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
\ No newline at end of file
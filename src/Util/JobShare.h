@@ -0,0 +1,82 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "Nocopy.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+// Runs parallel fors on a job system that may be shared with others while using at most a fixed number of its workers
+// at a time. Every thread running work for the share gets a slot that no other thread uses at the same time, so that
+// per thread data can be kept per slot. Slot 0 belongs to the thread that waits on the work and slots 1 to the width
+// belong to the runners on the job system
+class JobShare : Nocopy, Nomove
+{
+public:
+	// Called with a range of indices to process and the slot of the thread processing them
+	using Function = void(*)(void* userdata, size_t begin, size_t end, size_t slot);
+
+	// A parallel for over [0, count). Has to stay alive until it is done
+	class Batch : Nocopy, Nomove
+	{
+	public:
+		Batch(Function function, void* userdata, size_t count, size_t grain = 0);
+
+	private:
+		friend class JobShare;
+
+		Function m_function;
+		void* m_userdata;
+		size_t m_count;
+		size_t m_grain;
+
+		// The next index to hand out. Protected by the share mutex
+		size_t m_next = 0;
+
+		std::atomic_size_t m_remaining;
+	};
+
+	// The largest width as slots are kept in a 64 bit mask with slot 0 belonging to the waiting thread
+	constexpr static size_t k_max_width = 63;
+
+	JobShare(JobSystem& job_system, size_t width);
+	~JobShare();
+
+	// How many runners can be on the job system at once
+	size_t GetWidth() const;
+
+	void Start(Batch& batch);
+
+	bool IsDone(const Batch& batch) const;
+
+	// Help run the batch on this thread using slot 0 until it is done
+	void Wait(Batch& batch);
+
+private:
+	static void RunnerTask(void* userdata, size_t begin, size_t end);
+
+	// Start runners until there is one for each slot or there are as many as the chunks left to run
+	void StartRunners(size_t chunks);
+
+	// Take the next chunk from the only batch given or any batch when it is null
+	bool ClaimChunk(Batch* only, Batch*& batch_out, size_t& begin_out, size_t& end_out);
+
+	void RunChunk(Batch& batch, size_t begin, size_t end, size_t slot);
+
+	bool HasWork();
+
+private:
+	JobSystem& m_job_system;
+	size_t m_width;
+
+	JobSystem::Group m_runners;
+	std::atomic_size_t m_runner_count = 0;
+
+	// Slots of runners that are free to be taken
+	std::atomic_uint64_t m_free_slots;
+
+	// Batches that still have chunks to hand out, oldest first
+	std::mutex m_mutex;
+	std::deque<Batch*> m_batches;
+};
\ No newline at end of file
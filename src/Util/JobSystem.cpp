@@ -0,0 +1,397 @@
+#include "JobSystem.h"
+#include "Debug.h"
+
+#include <algorithm>
+
+namespace
+{
+	const size_t k_deque_initial_capacity = 256;
+
+	// How many times a worker looks for work before going to sleep
+	const size_t k_idle_spin_count = 64;
+
+	// How many grains each thread should get from a parallel for when no grain is given
+	const size_t k_grains_per_thread = 8;
+
+	thread_local void* current_worker = nullptr;
+}
+
+JobSystem::Group::~Group()
+{
+	DEBUG_ASSERT(IsDone(), "A group should be waited on before being destroyed");
+}
+
+bool JobSystem::Group::IsDone() const
+{
+	return m_pending.load(std::memory_order_seq_cst) == 0 && m_finishing.load(std::memory_order_seq_cst) == 0;
+}
+
+JobSystem::WorkDeque::Array::Array(size_t capacity) :
+	mask(capacity - 1),
+	items(new std::atomic<Task*>[capacity])
+{}
+
+JobSystem::WorkDeque::WorkDeque()
+{
+	m_arrays.push_back(std::make_unique<Array>(k_deque_initial_capacity));
+	m_array.store(m_arrays.back().get(), std::memory_order_relaxed);
+}
+
+void JobSystem::WorkDeque::Push(Task* task)
+{
+	int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+	int64_t top = m_top.load(std::memory_order_acquire);
+	Array* array = m_array.load(std::memory_order_relaxed);
+
+	// Grow when full, keeping the old array around for thieves that are still reading from it
+	if (bottom - top > int64_t(array->mask))
+	{
+		std::unique_ptr<Array> grown = std::make_unique<Array>((array->mask + 1) * 2);
+
+		for (int64_t i = top; i < bottom; i++)
+		{
+			grown->items[i & grown->mask].store(array->items[i & array->mask].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+
+		array = grown.get();
+		m_arrays.push_back(std::move(grown));
+		m_array.store(array, std::memory_order_release);
+	}
+
+	array->items[bottom & array->mask].store(task, std::memory_order_release);
+
+	std::atomic_thread_fence(std::memory_order_release);
+
+	m_bottom.store(bottom + 1, std::memory_order_relaxed);
+}
+
+JobSystem::Task* JobSystem::WorkDeque::Pop()
+{
+	int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+	Array* array = m_array.load(std::memory_order_relaxed);
+
+	m_bottom.store(bottom, std::memory_order_relaxed);
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	int64_t top = m_top.load(std::memory_order_relaxed);
+
+	if (top > bottom)
+	{
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Task* task = array->items[bottom & array->mask].load(std::memory_order_relaxed);
+
+	// The last task may be getting stolen at the same time so race the thieves for it
+	if (top == bottom)
+	{
+		if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			task = nullptr;
+		}
+
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+
+	return task;
+}
+
+JobSystem::Task* JobSystem::WorkDeque::Steal()
+{
+	int64_t top = m_top.load(std::memory_order_acquire);
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+	if (top >= bottom)
+	{
+		return nullptr;
+	}
+
+	Array* array = m_array.load(std::memory_order_acquire);
+	Task* task = array->items[top & array->mask].load(std::memory_order_acquire);
+
+	if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+	{
+		return nullptr;
+	}
+
+	return task;
+}
+
+bool JobSystem::WorkDeque::IsEmpty() const
+{
+	return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+}
+
+JobSystem::JobSystem(size_t worker_count)
+{
+	m_workers.reserve(worker_count);
+
+	for (size_t index = 0; index < worker_count; index++)
+	{
+		m_workers.push_back(std::make_unique<AlignedData<Worker>>());
+		m_workers.back()->system = this;
+		m_workers.back()->index = index;
+	}
+
+	m_threads.reserve(worker_count);
+
+	for (size_t index = 0; index < worker_count; index++)
+	{
+		m_threads.emplace_back(&JobSystem::WorkerLoop, this, index);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	m_running.store(false, std::memory_order_seq_cst);
+
+	m_signal.fetch_add(1, std::memory_order_seq_cst);
+	m_signal.notify_all();
+
+	for (std::thread& thread : m_threads)
+	{
+		thread.join();
+	}
+
+	DEBUG_ASSERT(m_injected.empty(), "All tasks should have been run before the job system is destroyed");
+}
+
+size_t JobSystem::GetWorkerCount() const
+{
+	return m_workers.size();
+}
+
+void JobSystem::Run(Group& group, Function function, void* userdata)
+{
+	ParallelFor(group, 1, function, userdata, 1);
+}
+
+void JobSystem::ParallelFor(Group& group, size_t count, Function function, void* userdata, size_t grain)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	if (grain == 0)
+	{
+		grain = std::max<size_t>(1, count / ((m_workers.size() + 1) * k_grains_per_thread));
+	}
+
+	group.m_pending.fetch_add(1, std::memory_order_relaxed);
+
+	Submit(new Task{ function, userdata, 0, count, grain, &group });
+}
+
+void JobSystem::Then(Group& group, Group& next, Function function, void* userdata)
+{
+	next.m_pending.fetch_add(1, std::memory_order_relaxed);
+
+	// Hold the group open while setting the continuation so that it is started even if the group is already done
+	group.m_pending.fetch_add(1, std::memory_order_relaxed);
+
+	Task* previous = group.m_continuation.exchange(new Task{ function, userdata, 0, 1, 1, &next }, std::memory_order_acq_rel);
+
+	DEBUG_ASSERT(previous == nullptr, "A group can only have one continuation at a time");
+
+	FinishTasks(group, 1);
+}
+
+void JobSystem::Wait(Group& group)
+{
+	Worker* worker = GetCurrentWorker();
+
+	while (!group.IsDone())
+	{
+		if (Task* task = FindTask(worker))
+		{
+			Execute(worker, task);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void JobSystem::WorkerLoop(size_t index)
+{
+	Worker* worker = m_workers[index].get();
+
+	current_worker = worker;
+
+	size_t idle_count = 0;
+
+	while (m_running.load(std::memory_order_relaxed))
+	{
+		if (Task* task = FindTask(worker))
+		{
+			Execute(worker, task);
+			idle_count = 0;
+			continue;
+		}
+
+		if (++idle_count < k_idle_spin_count)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		// Announce that we are going to sleep before checking for work one last time so that a submit can't be missed
+		m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+
+		uint32_t signal = m_signal.load(std::memory_order_seq_cst);
+
+		if (Task* task = FindTask(worker))
+		{
+			m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+			Execute(worker, task);
+			idle_count = 0;
+			continue;
+		}
+
+		if (m_running.load(std::memory_order_seq_cst))
+		{
+			m_signal.wait(signal, std::memory_order_seq_cst);
+		}
+
+		m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+		idle_count = 0;
+	}
+
+	current_worker = nullptr;
+}
+
+void JobSystem::Submit(Task* task)
+{
+	Worker* worker = GetCurrentWorker();
+
+	if (worker)
+	{
+		worker->deque.Push(task);
+	}
+	else
+	{
+		std::lock_guard lock(m_injected_mutex);
+		m_injected.push_back(task);
+		m_injected_count.fetch_add(1, std::memory_order_release);
+	}
+
+	m_signal.fetch_add(1, std::memory_order_seq_cst);
+
+	if (m_sleeping.load(std::memory_order_seq_cst) > 0)
+	{
+		m_signal.notify_one();
+	}
+}
+
+JobSystem::Task* JobSystem::FindTask(Worker* worker)
+{
+	if (worker)
+	{
+		if (Task* task = worker->deque.Pop())
+		{
+			return task;
+		}
+	}
+
+	if (m_injected_count.load(std::memory_order_acquire) > 0)
+	{
+		std::lock_guard lock(m_injected_mutex);
+
+		if (!m_injected.empty())
+		{
+			Task* task = m_injected.front();
+			m_injected.pop_front();
+			m_injected_count.fetch_sub(1, std::memory_order_relaxed);
+			return task;
+		}
+	}
+
+	// Steal from the other workers starting with the one after us so that thieves spread out
+	size_t start = worker ? worker->index + 1 : 0;
+
+	for (size_t i = 0; i < m_workers.size(); i++)
+	{
+		Worker* victim = m_workers[(start + i) % m_workers.size()].get();
+
+		if (victim == worker)
+		{
+			continue;
+		}
+
+		if (Task* task = victim->deque.Steal())
+		{
+			return task;
+		}
+	}
+
+	return nullptr;
+}
+
+void JobSystem::Execute(Worker* worker, Task* task)
+{
+	size_t begin = task->begin;
+
+	while (begin < task->end)
+	{
+		size_t remaining = task->end - begin;
+
+		// Split off the back half of the range when there is nothing queued so that idle workers have something to steal
+		bool queue_empty = worker ? worker->deque.IsEmpty() : m_injected_count.load(std::memory_order_relaxed) == 0;
+
+		if (remaining >= task->grain * 2 && queue_empty)
+		{
+			size_t middle = begin + remaining / 2;
+
+			Task* split = new Task(*task);
+			split->begin = middle;
+			task->end = middle;
+
+			task->group->m_pending.fetch_add(1, std::memory_order_relaxed);
+
+			Submit(split);
+			continue;
+		}
+
+		size_t end = std::min(begin + task->grain, task->end);
+
+		task->function(task->userdata, begin, end);
+
+		begin = end;
+	}
+
+	Group& group = *task->group;
+
+	delete task;
+
+	FinishTasks(group, 1);
+}
+
+void JobSystem::FinishTasks(Group& group, size_t count)
+{
+	// Waiters treat the group as busy while this is set so that it isn't destroyed while starting the continuation
+	group.m_finishing.fetch_add(1, std::memory_order_seq_cst);
+
+	if (group.m_pending.fetch_sub(count, std::memory_order_seq_cst) == count)
+	{
+		if (Task* continuation = group.m_continuation.exchange(nullptr, std::memory_order_acq_rel))
+		{
+			Submit(continuation);
+		}
+	}
+
+	group.m_finishing.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+JobSystem::Worker* JobSystem::GetCurrentWorker()
+{
+	Worker* worker = static_cast<Worker*>(current_worker);
+
+	return worker && worker->system == this ? worker : nullptr;
+}
\ No newline at end of file
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "Nocopy.h"
+#include "PerThread.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A work stealing job system that doesn't depend on the engine. Each worker owns a deque of tasks that it pushes to and
+// pops from the bottom while idle workers steal from the top of the others. Threads waiting on a group help run tasks
+// until the group is done so that tasks can start more tasks and wait on them
+class JobSystem : Nocopy, Nomove
+{
+public:
+	// Called with a range of indices to process
+	using Function = void(*)(void* userdata, size_t begin, size_t end);
+
+	class Group;
+
+	// A range of work. Ranges bigger than the grain are split in half when the worker running it has nothing queued
+	struct Task
+	{
+		Function function;
+		void* userdata;
+		size_t begin;
+		size_t end;
+		size_t grain;
+		Group* group;
+	};
+
+	// A set of tasks that can be waited on. A continuation task can be set to start once all tasks of the group are done
+	class Group : Nocopy, Nomove
+	{
+	public:
+		Group() {}
+		~Group();
+
+		bool IsDone() const;
+
+	private:
+		friend class JobSystem;
+
+		std::atomic_size_t m_pending = 0;
+		std::atomic_size_t m_finishing = 0;
+		std::atomic<Task*> m_continuation = nullptr;
+	};
+
+	// Chase-Lev deque where the owning worker pushes and pops from the bottom and others steal from the top
+	class WorkDeque : Nocopy, Nomove
+	{
+		struct Array
+		{
+			Array(size_t capacity);
+
+			size_t mask;
+			std::unique_ptr<std::atomic<Task*>[]> items;
+		};
+
+	public:
+		WorkDeque();
+
+		void Push(Task* task);
+		Task* Pop();
+		Task* Steal();
+
+		bool IsEmpty() const;
+
+	private:
+		alignas(k_cache_line) std::atomic_int64_t m_top = 0;
+		alignas(k_cache_line) std::atomic_int64_t m_bottom = 0;
+		std::atomic<Array*> m_array;
+
+		// Old arrays stay alive until the deque is destroyed as thieves may still be reading from them
+		std::vector<std::unique_ptr<Array>> m_arrays;
+	};
+
+public:
+	// The thread that waits on groups also runs tasks so usually one less worker than there are cores is wanted
+	JobSystem(size_t worker_count);
+	~JobSystem();
+
+	size_t GetWorkerCount() const;
+
+	// Run the function once as part of the group
+	void Run(Group& group, Function function, void* userdata);
+
+	// Run the function over the indices [0, count) as part of the group. A grain of 0 picks one from the count and
+	// the number of workers
+	void ParallelFor(Group& group, size_t count, Function function, void* userdata, size_t grain = 0);
+
+	// Run the function as part of the next group once all tasks in the group are done
+	void Then(Group& group, Group& next, Function function, void* userdata);
+
+	// Help run tasks until all of the groups tasks are done
+	void Wait(Group& group);
+
+private:
+	struct Worker
+	{
+		JobSystem* system = nullptr;
+		size_t index = 0;
+		WorkDeque deque;
+	};
+
+	void WorkerLoop(size_t index);
+
+	void Submit(Task* task);
+	Task* FindTask(Worker* worker);
+	void Execute(Worker* worker, Task* task);
+	void FinishTasks(Group& group, size_t count);
+
+	Worker* GetCurrentWorker();
+
+private:
+	std::vector<std::unique_ptr<AlignedData<Worker>>> m_workers;
+	std::vector<std::thread> m_threads;
+
+	// Tasks submitted by threads that aren't workers
+	std::mutex m_injected_mutex;
+	std::deque<Task*> m_injected;
+	std::atomic_size_t m_injected_count = 0;
+
+	// Bumped whenever new work is available so that sleeping workers wake up
+	alignas(k_cache_line) std::atomic_uint32_t m_signal = 0;
+	std::atomic_uint32_t m_sleeping = 0;
+	std::atomic_bool m_running = true;
+};
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "Debug.h"
 #include "Nocopy.h"
 #include "Util.h"
+#include "Serialize.h"
 
 #include <robin_hood/robin_hood.h>
 
@@ -10,12 +11,18 @@
 #include <vector>
 #include <memory>
 #include <bitset>
+#include <cstddef>
 #include <mutex>
 
 // A type that can be described as a runtime struct. One block of memory is allocated for each poly
 // but the memory is made up of multiple structs that are easily accessed
 
-#define POLY_DEBUG DEBUG_ENABLED
+#if defined(DEBUG_ENABLED)
+#define POLY_DEBUG
+#endif
+
+// How many poly checks each thread does between full checks against the set of created polys. 0 disables them
+#define POLY_DEBUG_SAMPLE_RATE 1024
 
 template<class T>
 static void ComponentConstruct(std::byte* ptr)
@@ -42,6 +49,20 @@ static void ComponentMove(std::byte* from, std::byte* to)
 	}
 }
 
+template<class T>
+static void ComponentCopy(const std::byte* from, std::byte* to)
+{
+	if constexpr (std::is_copy_constructible_v<T>)
+	{
+		new(reinterpret_cast<T*>(to)) T(*reinterpret_cast<const T*>(from));
+	}
+	else
+	{
+		// Components that can't be copied start default constructed
+		new(reinterpret_cast<T*>(to)) T();
+	}
+}
+
 template<class T>
 static void ComponentMoveAssign(std::byte* from, std::byte* to)
 {
@@ -55,22 +76,64 @@ static void ComponentMoveAssign(std::byte* from, std::byte* to)
 	}
 }
 
+// Components that can't be copied as raw bytes can provide these methods to be saved in snapshots
+template<class T>
+concept SerializableComponent = requires(const T& component, T& out_component, serialize::Writer& writer, serialize::Reader& reader)
+{
+	component.Serialize(writer);
+	out_component.Deserialize(reader);
+};
+
+// Components that hold pointers or other state that is only valid in this process can opt out of snapshots with
+// `constexpr static bool k_no_snapshot = true;`. They are left out and default constructed on restore
+template<class T>
+concept NoSnapshotComponent = requires { requires T::k_no_snapshot; };
+
+template<class T>
+static void ComponentSerialize(const std::byte* ptr, serialize::Writer& writer)
+{
+	reinterpret_cast<const T*>(ptr)->Serialize(writer);
+}
+
+template<class T>
+static void ComponentDeserialize(std::byte* ptr, serialize::Reader& reader)
+{
+	reinterpret_cast<T*>(ptr)->Deserialize(reader);
+}
+
 struct PolyTypeInfo
 {
 	using ComponentConstructCB = void (*)(std::byte*);
 	using ComponentDestructCB = void (*)(std::byte*);
 	using ComponentMoveCB = void (*)(std::byte*, std::byte*);
+	using ComponentCopyCB = void (*)(const std::byte*, std::byte*);
+	using ComponentSerializeCB = void (*)(const std::byte*, serialize::Writer&);
+	using ComponentDeserializeCB = void (*)(std::byte*, serialize::Reader&);
 
 	ComponentConstructCB construct = nullptr;
 	ComponentDestructCB destruct = nullptr;
 	ComponentMoveCB move = nullptr;
+	ComponentCopyCB copy = nullptr;
 	size_t size = 0;
+	bool trivial = false; // Can be saved and restored as raw bytes
+	ComponentSerializeCB serialize = nullptr; // Set when the component saves itself
+	ComponentDeserializeCB deserialize = nullptr;
 };
 
 template<class T>
 constexpr PolyTypeInfo MakeTypeInfo()
 {
-	return { ComponentConstruct<T>, ComponentDestruct<T>, ComponentMove<T>, sizeof(T) };
+	// Polys and prefabs only align their components to max_align_t
+	static_assert(alignof(T) <= alignof(std::max_align_t), "Components can't be aligned more than max_align_t");
+
+	if constexpr (SerializableComponent<T>)
+	{
+		return { ComponentConstruct<T>, ComponentDestruct<T>, ComponentMove<T>, ComponentCopy<T>, sizeof(T), false, ComponentSerialize<T>, ComponentDeserialize<T> };
+	}
+	else
+	{
+		return { ComponentConstruct<T>, ComponentDestruct<T>, ComponentMove<T>, ComponentCopy<T>, sizeof(T), std::is_trivially_copyable_v<T> && !NoSnapshotComponent<T> };
+	}
 }
 
 // A system for creating runtime defined structs which are efficently allocated in memory
@@ -84,6 +147,11 @@ private:
 	constexpr static const uint16_t k_invalid_offset = UINT16_MAX;
 	constexpr static const size_t k_num_types = N;
 
+#if defined(POLY_DEBUG)
+	constexpr static const uint32_t k_alive_magic = 0x9017A11E;
+	constexpr static const uint32_t k_dead_magic = 0x9017DEAD;
+#endif
+
 	template<class T>
 	static const size_t k_type_index;
 
@@ -93,6 +161,9 @@ public:
 	struct Header
 	{
 		DerivedT* archetype = nullptr;
+#if defined(POLY_DEBUG)
+		uint32_t debug_magic = 0; // Only k_alive_magic while the poly is allocated
+#endif
 	};
 
 	// Use a bitset for fast type logic
@@ -256,10 +327,7 @@ public:
 		DEBUG_ASSERT(m_type_offsets[k_type_index<T>] != 0, "Either T == HeaderT or this poly doesn't have this type");
 
 #if defined(POLY_DEBUG)
-		{
-			std::lock_guard lock(m_created_mutex);
-			DEBUG_ASSERT(m_created.contains(poly), "We didn't create this poly");
-		}
+		DebugCheckPoly(poly);
 #endif
 
 		std::byte* ptr = reinterpret_cast<std::byte*>(poly);
@@ -285,15 +353,17 @@ public:
 
 		Header* poly = reinterpret_cast<Header*>(malloc(m_total_size));
 
+		poly->archetype = static_cast<DerivedT*>(this);
+
 #if defined(POLY_DEBUG)
+		poly->debug_magic = k_alive_magic;
+
 		{
 			std::lock_guard lock(m_created_mutex);
 			m_created.insert(poly);
 		}
 #endif
 
-		poly->archetype = static_cast<DerivedT*>(this);
-
 		return reinterpret_cast<Header*>(poly);
 	}
 
@@ -302,6 +372,11 @@ public:
 		DEBUG_ASSERT(poly != nullptr, "A valid poly should be provided for deallocation");
 
 #if defined(POLY_DEBUG)
+		DebugCheckPoly(poly);
+
+		// Catch pointers to this poly that are used after it is freed for as long as the memory isn't reused
+		poly->debug_magic = k_dead_magic;
+
 		{
 			std::lock_guard lock(m_created_mutex);
 			DEBUG_ASSERT(m_created.contains(poly), "We didn't create this poly");
@@ -316,10 +391,7 @@ public:
 	{
 		DEBUG_ASSERT(poly != nullptr, "A valid poly should be provided for construction");
 #if defined(POLY_DEBUG)
-		{
-			std::lock_guard lock(m_created_mutex);
-			DEBUG_ASSERT(m_created.contains(poly), "We didn't create this poly");
-		}
+		DebugCheckPoly(poly);
 #endif
 
 		std::byte* ptr = reinterpret_cast<std::byte*>(poly);
@@ -337,10 +409,7 @@ public:
 	{
 		DEBUG_ASSERT(poly != nullptr, "A valid poly should be provided for destruction");
 #if defined(POLY_DEBUG)
-		{
-			std::lock_guard lock(m_created_mutex);
-			DEBUG_ASSERT(m_created.contains(poly), "We didn't create this poly");
-		}
+		DebugCheckPoly(poly);
 #endif
 
 		std::byte* ptr = reinterpret_cast<std::byte*>(poly);
@@ -379,6 +448,27 @@ public:
 	}
 
 private:
+#if defined(POLY_DEBUG)
+	// Check that the poly is alive and was created by us without locking. Every so often also
+	// check the set of created polys which catches memory that was reused by another poly.
+	void DebugCheckPoly(const Header* poly) const
+	{
+		DEBUG_ASSERT(poly->debug_magic == k_alive_magic, "The poly isn't alive");
+		DEBUG_ASSERT(poly->archetype == static_cast<const DerivedT*>(this), "We didn't create this poly");
+
+		if constexpr (POLY_DEBUG_SAMPLE_RATE != 0)
+		{
+			thread_local uint32_t check_count = 0;
+
+			if (++check_count % POLY_DEBUG_SAMPLE_RATE == 0)
+			{
+				std::lock_guard lock(m_created_mutex);
+				DEBUG_ASSERT(m_created.contains(poly), "We didn't create this poly");
+			}
+		}
+	}
+#endif
+
 	ID m_id;
 	std::array<uint16_t, k_num_types> m_type_offsets;
 	uint16_t m_total_size = 0;
@@ -388,4 +478,56 @@ private:
 	robin_hood::unordered_set<const Header*> m_created;
 	mutable std::mutex m_created_mutex;
 #endif
+};
+
+// An archetype of a PolyType whose components are known at compile time. The offsets are computed with
+// constexpr so component access is plain pointer arithmetic. A PolyType initialized with InitType has the
+// same layout so polys created at runtime can be accessed through the static type.
+template<class PolyTypeT, class... Types>
+class StaticPolyType
+{
+public:
+	using Header = typename PolyTypeT::Header;
+	using ID = typename PolyTypeT::ID;
+
+	// The offset of a component from the start of the poly. Components are laid out in order after the header.
+	template<class T>
+	constexpr static uint16_t GetOffset()
+	{
+		static_assert((std::is_same_v<T, Types> || ...), "The static type doesn't have this component");
+
+		size_t offset = sizeof(Header);
+		bool found = false;
+
+		((found = found || std::is_same_v<T, Types>, offset += found ? 0 : sizeof(Types)), ...);
+
+		return static_cast<uint16_t>(offset);
+	}
+
+	template<class T>
+	constexpr static uint16_t k_offset = GetOffset<T>();
+
+	constexpr static uint16_t k_size = static_cast<uint16_t>((sizeof(Header) + ... + sizeof(Types)));
+
+	static ID GetID()
+	{
+		return PolyTypeT::CreateTypeID<Header, Types...>();
+	}
+
+	// Add the components to a runtime type in the static order
+	static void InitType(PolyTypeT& type)
+	{
+		(type.AddType<Types>(), ...);
+
+		DEBUG_ASSERT(type.GetSize() == k_size, "The runtime layout should match the static layout");
+	}
+
+	template<class T>
+	static T& Get(Header* poly)
+	{
+		DEBUG_ASSERT(poly != nullptr, "The poly should be stored individually");
+		DEBUG_ASSERT(poly->archetype->OffsetOf<T>() == k_offset<T>, "The polys archetype wasn't laid out by this static type");
+
+		return *reinterpret_cast<T*>(reinterpret_cast<std::byte*>(poly) + k_offset<T>);
+	}
 };
\ No newline at end of file
@@ -1,7 +1,10 @@
 #pragma once
 
 #include "Poly.h"
+#include "Span.h"
 #include "Callback.h"
+#include "PerThread.h"
+#include "SmallVector.h"
 
 #include <robin_hood/robin_hood.h>
 
@@ -20,6 +23,12 @@ enum class PolyEvent : uint32_t
 	Count,
 };
 
+enum class PolyStorage : uint8_t
+{
+	Individual, // Each poly is allocated by itself with its components next to each other
+	Chunked, // Polys are packed into fixed size chunks with an array for each component
+};
+
 // A registry that manages creating polys of multiple archetypes of the same base type.
 // It also supports quick iteration of all polys that have a certain set of components.
 
@@ -31,40 +40,319 @@ class PolyFactory : Nocopy, Nomove
 public:
 	class Ref;
 	class WeakRef;
+	class ChunkView;
+	class Query;
+	class Prefab;
 	struct CallbackEntry;
 
 	using EventCallback = cb::Callback<void(WeakRef)>;
 	using EventCallbacks = std::vector<EventCallback>;
 	using TypeCallbacks = std::array<EventCallbacks, to_underlying(PolyEvent::Count)>;
 
+	// Called once with many polys of the same archetype to avoid dispatching each poly by itself
+	using BatchEventCallback = cb::Callback<void(Span<WeakRef>)>;
+	using BatchEventCallbacks = std::vector<BatchEventCallback>;
+	using TypeBatchCallbacks = std::array<BatchEventCallbacks, to_underlying(PolyEvent::Count)>;
+
+	// The size of each block of polys when using chunked storage
+	constexpr static size_t k_chunk_size = 16 * 1024;
+	constexpr static size_t k_chunk_align = 64;
+
+private:
+	// A fixed size block of polys that all share an archetype. Each component is stored in its own array
+	// and the header array stores the entry of each poly instead of the archetype
+	struct Chunk : Nocopy, Nomove
+	{
+		alignas(k_chunk_align) std::array<std::byte, k_chunk_size - k_chunk_align> data;
+		uint32_t count = 0;
+		uint32_t index = 0; // The position of the chunk in its archetype
+	};
+
+public:
 	// An factory archetype that also stores all callbacks that listen for a subset of this archetypes types
 	class Archetype : public PolyType<Archetype, N>
 	{
 	public:
-		Archetype() {}
+		Archetype()
+		{
+			m_column_offsets.fill(Archetype::k_invalid_offset);
+			m_tick_offsets.fill(Archetype::k_invalid_offset);
+		}
 
 		void AddCallback(PolyEvent event, EventCallback callback)
 		{
 			m_type_callbacks[to_underlying(event)].push_back(callback);
 		}
 
+		void AddBatchCallback(PolyEvent event, BatchEventCallback callback)
+		{
+			m_type_batch_callbacks[to_underlying(event)].push_back(callback);
+		}
+
 		void DoEvent(PolyEvent event, WeakRef poly) const
 		{
 			for (const EventCallback& callback : m_type_callbacks[to_underlying(event)])
 			{
 				callback(poly);
 			}
+
+			for (const BatchEventCallback& callback : m_type_batch_callbacks[to_underlying(event)])
+			{
+				callback(Span<WeakRef>(&poly, 1));
+			}
+		}
+
+		// Run the event for polys that all have this archetype. Batch callbacks get them all at once
+		void DoBatchEvent(PolyEvent event, Span<WeakRef> polys) const
+		{
+			for (const BatchEventCallback& callback : m_type_batch_callbacks[to_underlying(event)])
+			{
+				callback(polys);
+			}
+
+			for (const EventCallback& callback : m_type_callbacks[to_underlying(event)])
+			{
+				for (WeakRef poly : polys)
+				{
+					callback(poly);
+				}
+			}
+		}
+
+		bool HasCallbacks(PolyEvent event) const
+		{
+			return !m_type_callbacks[to_underlying(event)].empty() || !m_type_batch_callbacks[to_underlying(event)].empty();
+		}
+
+		PolyStorage GetStorage() const
+		{
+			return m_storage;
+		}
+
+		uint32_t GetChunkCapacity() const
+		{
+			return m_chunk_capacity;
+		}
+
+		// Get the array of a component in a chunk of this archetype
+		std::byte* GetColumn(Chunk& chunk, size_t index) const
+		{
+			DEBUG_ASSERT(m_storage == PolyStorage::Chunked, "This archetype doesn't store polys in chunks");
+			DEBUG_ASSERT(m_column_offsets[index] != Archetype::k_invalid_offset, "This archetype doesn't have this type");
+
+			return chunk.data.data() + m_column_offsets[index];
+		}
+
+		template<class T>
+		T* GetColumn(Chunk& chunk) const
+		{
+			return reinterpret_cast<T*>(GetColumn(chunk, Archetype::k_type_index<T>));
+		}
+
+		// Get the array of change ticks of a tracked component in a chunk or nullptr if it isn't tracked
+		uint32_t* GetChangeTicks(Chunk& chunk, size_t index) const
+		{
+			if (m_tick_offsets[index] == Archetype::k_invalid_offset)
+			{
+				return nullptr;
+			}
+
+			return reinterpret_cast<uint32_t*>(chunk.data.data() + m_tick_offsets[index]);
+		}
+
+		// Get the last tick any row of a tracked component in the chunk was written
+		uint32_t GetChunkChangeTick(Chunk& chunk, size_t index) const
+		{
+			DEBUG_ASSERT(m_tick_offsets[index] != Archetype::k_invalid_offset, "This component isn't tracked");
+
+			return std::atomic_ref(GetChunkTicks(chunk)[index]).load(std::memory_order_relaxed);
+		}
+
+		// Mark the rows [begin, end) of a component as written in the current tick. Does nothing if the component isn't tracked
+		void MarkChanged(Chunk& chunk, size_t index, uint32_t begin, uint32_t end) const
+		{
+			uint32_t* ticks = GetChangeTicks(chunk, index);
+
+			if (ticks == nullptr)
+			{
+				return;
+			}
+
+			uint32_t tick = m_change_tick->load(std::memory_order_relaxed);
+
+			std::fill(ticks + begin, ticks + end, tick);
+
+			// Workers writing other rows of the chunk store the same tick
+			std::atomic_ref(GetChunkTicks(chunk)[index]).store(tick, std::memory_order_relaxed);
+		}
+
+		// Mark every tracked component of a new row as written
+		void MarkRowChanged(Chunk& chunk, uint32_t row) const
+		{
+			if (m_tracked_types.none())
+			{
+				return;
+			}
+
+			for (size_t i = 1; i < Archetype::k_num_types; i++)
+			{
+				MarkChanged(chunk, i, row, row + 1);
+			}
+		}
+
+		// Move the change ticks of a row when the row is moved into a gap
+		void MoveRowTicks(Chunk& from_chunk, uint32_t from_row, Chunk& to_chunk, uint32_t to_row) const
+		{
+			if (m_tracked_types.none())
+			{
+				return;
+			}
+
+			for (size_t i = 1; i < Archetype::k_num_types; i++)
+			{
+				if (uint32_t* from = GetChangeTicks(from_chunk, i))
+				{
+					uint32_t tick = from[from_row];
+
+					GetChangeTicks(to_chunk, i)[to_row] = tick;
+
+					// The row can be newer than the rest of its new chunk which would then be skipped as unchanged
+					std::atomic_ref chunk_tick(GetChunkTicks(to_chunk)[i]);
+
+					if (chunk_tick.load(std::memory_order_relaxed) < tick)
+					{
+						chunk_tick.store(tick, std::memory_order_relaxed);
+					}
+				}
+			}
+		}
+
+		// Setup the parts of a new chunk that aren't per row
+		void InitChunk(Chunk& chunk) const
+		{
+			if (m_tracked_types.any())
+			{
+				std::fill_n(GetChunkTicks(chunk), N, 0);
+			}
+		}
+
+		// Switch to chunked storage and layout the component arrays. All types should be added first.
+		// Tracked components also get an array with the tick each row was last written.
+		void InitChunks(typename PolyType<Archetype, N>::ID tracked_types, const std::atomic_uint32_t* change_tick)
+		{
+			size_t row_size = 0;
+			size_t num_columns = 0;
+
+			m_tracked_types = tracked_types & this->GetID();
+			m_change_tick = change_tick;
+
+			for (size_t i = 0; i < Archetype::k_num_types; i++)
+			{
+				if (this->m_type_offsets[i] != Archetype::k_invalid_offset)
+				{
+					row_size += Archetype::k_type_info[i].size;
+					num_columns++;
+
+					if (m_tracked_types.test(i))
+					{
+						row_size += sizeof(uint32_t);
+						num_columns++;
+					}
+				}
+			}
+
+			size_t offset = 0;
+
+			// The last change tick of each component in the chunk goes before the arrays
+			if (m_tracked_types.any())
+			{
+				offset = (N * sizeof(uint32_t) + k_chunk_align - 1) & ~(k_chunk_align - 1);
+			}
+
+			// Leave room to align the start of each array
+			m_chunk_capacity = static_cast<uint32_t>((sizeof(Chunk::data) - offset - num_columns * k_chunk_align) / row_size);
+
+			DEBUG_ASSERT(m_chunk_capacity > 0, "The archetype is too large to fit in a chunk");
+
+			for (size_t i = 0; i < Archetype::k_num_types; i++)
+			{
+				if (this->m_type_offsets[i] != Archetype::k_invalid_offset)
+				{
+					m_column_offsets[i] = static_cast<uint16_t>(offset);
+
+					offset += Archetype::k_type_info[i].size * m_chunk_capacity;
+					offset = (offset + k_chunk_align - 1) & ~(k_chunk_align - 1);
+
+					if (m_tracked_types.test(i))
+					{
+						m_tick_offsets[i] = static_cast<uint16_t>(offset);
+
+						offset += sizeof(uint32_t) * m_chunk_capacity;
+						offset = (offset + k_chunk_align - 1) & ~(k_chunk_align - 1);
+					}
+				}
+			}
+
+			DEBUG_ASSERT(offset <= sizeof(Chunk::data), "The chunk layout overflowed");
+
+			m_storage = PolyStorage::Chunked;
+		}
+
+	private:
+		uint32_t* GetChunkTicks(Chunk& chunk) const
+		{
+			return reinterpret_cast<uint32_t*>(chunk.data.data());
 		}
 
 	private:
 		// Callbacks that are listening to types that this archetype has
 		TypeCallbacks m_type_callbacks;
+		TypeBatchCallbacks m_type_batch_callbacks;
+
+		PolyStorage m_storage = PolyStorage::Individual;
+
+		// The offset of each components array in a chunk
+		std::array<uint16_t, N> m_column_offsets;
+		uint32_t m_chunk_capacity = 0;
+
+		// The offset of the change tick array of each tracked component in a chunk
+		typename PolyType<Archetype, N>::ID m_tracked_types;
+		std::array<uint16_t, N> m_tick_offsets;
+		const std::atomic_uint32_t* m_change_tick = nullptr;
 	};
 
 	using Header = typename PolyType<Archetype, N>::Header;
 	using TypeID = typename PolyType<Archetype, N>::ID;
 	using Ptr = typename PolyType<Archetype, N>::Ptr;
 
+	// A handle to a poly that is safe to keep across frames. When a poly is destroyed its slot moves to a
+	// new generation so old handles resolve to an empty WeakRef instead of dangling.
+	struct Handle
+	{
+		uint32_t slot = 0;
+		uint32_t generation = 0; // Live polys never use generation 0
+
+		bool operator==(const Handle& other) const
+		{
+			return slot == other.slot && generation == other.generation;
+		}
+
+		bool operator!=(const Handle& other) const
+		{
+			return !(*this == other);
+		}
+
+		operator bool() const
+		{
+			return generation != 0;
+		}
+
+		uint64_t Hash() const
+		{
+			return (static_cast<uint64_t>(generation) << 32) | slot;
+		}
+	};
+
 private:
 	struct CallbackEntry
 	{
@@ -72,32 +360,91 @@ private:
 		EventCallback callback;
 	};
 
+	struct BatchCallbackEntry
+	{
+		PolyEvent event;
+		BatchEventCallback callback;
+	};
+
+	// Where the memory of a poly is stored
+	struct PolyData
+	{
+		Archetype* archetype = nullptr;
+		Header* header = nullptr; // Set when the archetype stores polys individually
+		Chunk* chunk = nullptr; // Set when the archetype stores polys in chunks
+		uint32_t row = 0; // The row in the chunk or the index in the archetypes list of individual polys
+	};
+
+	struct PolyEntry;
+	struct Shard;
+
+	using PolyMapEntry = robin_hood::pair<const PolyID, PolyEntry>;
+
 	// An archetype entry that polys will reference.
 	struct ArchetypeEntry : Nomove, Nocopy
 	{
 		Archetype archetype;
 		size_t refcount = 0;
-		std::vector<Header*> polys;
+		std::vector<Header*> polys; // Used with individual storage
+		std::vector<PolyMapEntry*> owners; // The entry of each individual poly so rows can be fixed when swap removing
+		std::vector<std::unique_ptr<Chunk>> chunks; // Used with chunked storage. Only the last chunk isn't full
 	};
 
 	// Use a node map so that the entry memory is stable
 	using ArchetypeMap = robin_hood::unordered_node_map<TypeID, ArchetypeEntry>;
 
+	// Set in the refcount while a poly is queued to be reclaimed
+	constexpr static size_t k_reclaim_queued = size_t(1) << (sizeof(size_t) * 8 - 1);
+
 	// A poly entry that multiple refs will reference.
 	struct PolyEntry
 	{
 		TypeID type_id; // The archetype has the type id but this avoids double indirection for a Ref
-		Archetype* archetype = nullptr;
-		Header* header = nullptr;
+		PolyData data;
 		std::atomic_size_t refcount = 0;
+		Shard* shard = nullptr;
+		PolyMapEntry* next_reclaim = nullptr;
+		uint32_t slot = 0;
+		uint32_t generation = 0;
 	};
 
 	// Use a node map so that the entry memory is stable
 	using PolyMap = robin_hood::unordered_node_map<PolyID, PolyEntry>;
 
-	using PolyMapEntry = typename PolyMap::value_type;
+	static_assert(std::is_same_v<typename PolyMap::value_type, PolyMapEntry>, "The entry type should match the map");
+	static_assert(sizeof(Header) >= sizeof(PolyMapEntry*), "Chunks store entries in the header array");
+
+	// Polys are spread over shards by their id so that threads creating and finding polys rarely wait on each other
+	constexpr static size_t k_shard_bits = 5;
+	constexpr static size_t k_num_shards = 1ull << k_shard_bits;
+
+	// Increase when the snapshot layout changes
+	constexpr static size_t k_snapshot_version = 0;
+
+	struct Shard : Nocopy, Nomove
+	{
+		PolyMap entries;
+		mutable tkrzw::SpinSharedMutex mutex;
+
+		// Polys that lost their last reference and may need to be reclaimed
+		std::atomic<PolyMapEntry*> reclaim_list = nullptr;
+	};
+
+	// Handles index into pages of slots that are never moved so they can be resolved without locking
+	struct Slot
+	{
+		std::atomic<PolyMapEntry*> entry = nullptr;
+		std::atomic_uint32_t generation = 1;
+	};
+
+	constexpr static size_t k_slot_page_bits = 12;
+	constexpr static size_t k_slot_page_size = 1ull << k_slot_page_bits;
+	constexpr static size_t k_max_slot_pages = 4096;
+
+	using SlotPage = std::array<Slot, k_slot_page_size>;
 
 	using CallbackEntries = std::vector<CallbackEntry>;
+	using BatchCallbackEntries = std::vector<BatchCallbackEntry>;
 
 public:
 	// A reference to a poly that doesn't increase the refcount. Useful for thread safe per frame iteration.
@@ -119,22 +466,32 @@ public:
 
 		const Archetype* GetType() const
 		{
-			return m_entry->second.archetype;
+			return m_entry->second.data.archetype;
 		}
 
+		// Chunked polys don't have a header so use Get instead
 		Header* GetHeader() const
 		{
-			return m_entry->second.header;
+			DEBUG_ASSERT(m_entry->second.data.chunk == nullptr, "Chunked polys don't have a header");
+
+			return m_entry->second.data.header;
 		}
 
+		// Chunked polys can't be pointed to so use Get instead
 		Ptr GetPtr() const
 		{
 			return Ptr{ GetHeader() };
 		}
 
+		Handle GetHandle() const
+		{
+			return Handle{ m_entry->second.slot, m_entry->second.generation };
+		}
+
 		void* Data()
 		{
-			return reinterpret_cast<void*>(GetHeader());
+			// Chunked polys move when others are removed so use the entry which is stable
+			return m_entry->second.data.chunk != nullptr ? reinterpret_cast<void*>(m_entry) : reinterpret_cast<void*>(GetHeader());
 		}
 
 		template<class... Types>
@@ -148,6 +505,14 @@ public:
 		T& Get() const
 		{
 			DEBUG_ASSERT(Has<T>(), "We should have this type");
+
+			const PolyData& data = m_entry->second.data;
+
+			if (data.chunk != nullptr)
+			{
+				return data.archetype->GetColumn<T>(*data.chunk)[data.row];
+			}
+
 			return *GetType()->Get<T>(GetHeader());
 		}
 
@@ -157,6 +522,20 @@ public:
 			return Has<T>() ? &Get<T>() : nullptr;
 		}
 
+		// Get a component to change it. The component is marked as changed in the current tick if it is tracked.
+		template<class T>
+		T& Write() const
+		{
+			const PolyData& data = m_entry->second.data;
+
+			if (data.chunk != nullptr)
+			{
+				data.archetype->MarkChanged(*data.chunk, Archetype::k_type_index<T>, data.row, data.row + 1);
+			}
+
+			return Get<T>();
+		}
+
 		template<auto Member,
 			class Ret = get_member_type<decltype(Member)>::type,
 			class Class = get_member_class<decltype(Member)>::type>
@@ -220,7 +599,7 @@ public:
 		{
 			if (m_entry != nullptr)
 			{
-				m_entry->second.refcount.fetch_sub(1, std::memory_order_release);
+				Release(m_entry);
 			}
 		}
 
@@ -234,7 +613,7 @@ public:
 		{
 			if (m_entry != nullptr)
 			{
-				m_entry->second.refcount.fetch_sub(1, std::memory_order_release);
+				Release(m_entry);
 			}
 
 			m_entry = other.m_entry;
@@ -248,327 +627,1895 @@ public:
 		}
 	};
 
-public:
-	PolyFactory() {}
-
-	// Get a reference to a poly with the given PolyID or create one if needed.
-	Ref GetPoly(PolyID id, TypeID initial_types = TypeID{})
+	// A view of the polys in one chunk. Each component is a contiguous array that can be looped over linearly.
+	// The view is only valid until polys of its archetype are created, destroyed or change type.
+	class ChunkView
 	{
-		std::lock_guard lock(m_mutex);
-
-		auto&& [it, created] = m_entries.try_emplace(id);
+	public:
+		ChunkView(const Archetype* archetype, Chunk* chunk) : ChunkView(archetype, chunk, 0, chunk->count) {}
 
-		PolyEntry& entry = it->second;
+		// A view of only the rows [begin, end) of the chunk
+		ChunkView(const Archetype* archetype, Chunk* chunk, size_t begin, size_t end) :
+			m_archetype(archetype),
+			m_chunk(chunk),
+			m_begin(static_cast<uint32_t>(begin)),
+			m_end(static_cast<uint32_t>(end))
+		{}
 
-		if (created)
+		size_t Size() const
 		{
-			entry.type_id = initial_types | Archetype::CreateTypeID<Header>();
-			entry.header = AllocatePoly(entry.type_id);
-			entry.archetype = entry.header->archetype;
+			return m_end - m_begin;
+		}
 
-			DEBUG_ASSERT(entry.type_id == entry.archetype->GetID(), "The archetype we got doesn't have the right type");
+		const Archetype* GetType() const
+		{
+			return m_archetype;
+		}
 
-			entry.archetype->ConstructPoly(entry.header);
+		template<class... Types>
+		bool Has() const
+		{
+			return m_archetype->Has<Types...>();
 		}
 
-		return Ref(&*it);
-	}
+		template<class T>
+		Span<T> Get() const
+		{
+			DEBUG_ASSERT(Has<T>(), "We should have this type");
+			return Span<T>(m_archetype->GetColumn<T>(*m_chunk) + m_begin, Size());
+		}
 
-	// Update the type of a poly to a new type. Any components that are in both
-	// will be moved while the rest will be destroyed/newly constructed.
-	void SetTypes(PolyID id, TypeID new_type_id)
-	{
-		std::lock_guard lock(m_mutex);
+		// Get a component array to change it. Every row in the view is marked as changed if the component is tracked.
+		template<class T>
+		Span<T> Write() const
+		{
+			m_archetype->MarkChanged(*m_chunk, Archetype::k_type_index<T>, m_begin, m_end);
 
-		auto it = m_entries.find(id);
+			return Get<T>();
+		}
 
-		if (it == m_entries.end())
+		// Check if any row of the chunk wrote the component after the tick. Untracked components always count as changed.
+		template<class T>
+		bool HasChanged(uint32_t since_tick) const
 		{
-			return;
+			if (m_archetype->GetChangeTicks(*m_chunk, Archetype::k_type_index<T>) == nullptr)
+			{
+				return true;
+			}
+
+			return m_archetype->GetChunkChangeTick(*m_chunk, Archetype::k_type_index<T>) > since_tick;
 		}
 
-		PolyEntry& entry = it->second;
+		// Get the tick each row last wrote the component. Empty if the component isn't tracked.
+		template<class T>
+		Span<uint32_t> GetChangeTicks() const
+		{
+			uint32_t* ticks = m_archetype->GetChangeTicks(*m_chunk, Archetype::k_type_index<T>);
 
-		new_type_id |= Archetype::CreateTypeID<Header>();
+			return ticks != nullptr ? Span<uint32_t>(ticks + m_begin, Size()) : Span<uint32_t>();
+		}
 
-		Header* new_poly = UpdatePolyType(entry.header, entry.type_id, new_type_id);
+		WeakRef GetPoly(size_t index) const
+		{
+			DEBUG_ASSERT(index < Size(), "The index is out of the chunks range");
+			return WeakRef(GetChunkEntries(*m_archetype, *m_chunk)[m_begin + index]);
+		}
 
-		entry.type_id = new_type_id;
-		entry.archetype = new_poly->archetype;
-		entry.header = new_poly;
-	}
+	private:
+		const Archetype* m_archetype;
+		Chunk* m_chunk;
+		uint32_t m_begin;
+		uint32_t m_end;
+	};
 
-	// Add new components if they don't already exist to a poly.
-	// The existing components will be moved.
-	void AddTypes(PolyID id, TypeID new_types)
+	// A cached list of the archetypes that have all the required types and none of the excluded types.
+	// The factory keeps it up to date as archetypes are created and destroyed so iterating doesn't
+	// need to match every archetype again.
+	class Query : Nocopy, Nomove
 	{
-		std::lock_guard lock(m_mutex);
+	public:
+		Query(TypeID required, TypeID excluded) : m_required(required), m_excluded(excluded) {}
 
-		auto it = m_entries.find(id);
+		bool Matches(TypeID type_id) const
+		{
+			return (type_id & m_required) == m_required && (type_id & m_excluded).none();
+		}
 
-		if (it == m_entries.end())
+		TypeID GetRequired() const
 		{
-			return;
+			return m_required;
 		}
 
-		PolyEntry& entry = it->second;
+		TypeID GetExcluded() const
+		{
+			return m_excluded;
+		}
 
-		TypeID new_type_id = entry.type_id | new_types;
-		
-		Header* new_poly = UpdatePolyType(entry.header, entry.type_id, new_type_id);
+	private:
+		friend class PolyFactory;
 
-		entry.type_id = new_type_id;
-		entry.archetype = new_poly->archetype;
-		entry.header = new_poly;
-	}
+		TypeID m_required;
+		TypeID m_excluded;
+		std::vector<ArchetypeEntry*> m_archetypes;
+	};
 
-	// Iterate over all polys that have the given components
-	void Iterate(TypeID types, cb::Callback<void(Ptr)> callback) const
+	// A fully set up template of an archetype that new polys can be copied from. Trivially
+	// copyable components are copied as raw bytes while the rest are copy constructed.
+	class Prefab : Nocopy, Nomove
 	{
-		std::shared_lock lock(m_mutex);
-
-		for (auto&& [type_id, entry] : m_archetypes)
+	public:
+		explicit Prefab(TypeID type_id) :
+			m_type_id(type_id | Archetype::CreateTypeID<Header>())
 		{
-			if ((type_id & types) == types)
+			m_offsets.fill(Archetype::k_invalid_offset);
+
+			size_t size = 0;
+
+			for (size_t i = 1; i < Archetype::k_num_types; i++)
 			{
-				for (Ptr poly : entry.polys)
+				if (m_type_id.test(i))
 				{
-					callback(poly);
+					m_offsets[i] = static_cast<uint16_t>(size);
+
+					size += Archetype::k_type_info[i].size;
+					size = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
 				}
 			}
-		}
-	}
 
-	// Iterate over all polys that have the given components. Do only part
-	// of the work for the current worker.
-	void WorkerIterate(TypeID types, size_t worker_count, size_t worker_index, cb::Callback<void(Ptr)> callback) const
-	{
-		std::shared_lock lock(m_mutex);
+			// Round up as max_align_t can be bigger than its alignment
+			m_data.resize((size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t));
 
+			for (size_t i = 1; i < Archetype::k_num_types; i++)
+			{
+				if (m_type_id.test(i))
+				{
+					Archetype::k_type_info[i].construct(GetData(i));
+				}
+			}
+		}
+
+		~Prefab()
+		{
+			for (size_t i = 1; i < Archetype::k_num_types; i++)
+			{
+				if (m_type_id.test(i))
+				{
+					Archetype::k_type_info[i].destruct(GetData(i));
+				}
+			}
+		}
+
+		TypeID GetTypeID() const
+		{
+			return m_type_id;
+		}
+
+		template<class... Types>
+		bool Has() const
+		{
+			TypeID partial_id = Archetype::CreateTypeID<Types...>();
+			return (m_type_id & partial_id) == partial_id;
+		}
+
+		template<class T>
+		T& Get()
+		{
+			DEBUG_ASSERT(Has<T>(), "The prefab should have this type");
+			return *reinterpret_cast<T*>(GetData(Archetype::k_type_index<T>));
+		}
+
+		template<class T, class Ret>
+		Ret& operator->*(Ret T::* Member)
+		{
+			return Get<T>().*Member;
+		}
+
+	private:
+		friend class PolyFactory;
+
+		std::byte* GetData(size_t index)
+		{
+			return reinterpret_cast<std::byte*>(m_data.data()) + m_offsets[index];
+		}
+
+		const std::byte* GetData(size_t index) const
+		{
+			return reinterpret_cast<const std::byte*>(m_data.data()) + m_offsets[index];
+		}
+
+		TypeID m_type_id;
+		std::array<uint16_t, N> m_offsets;
+		std::vector<std::max_align_t> m_data;
+	};
+
+public:
+	PolyFactory() {}
+
+	~PolyFactory()
+	{
+		for (std::atomic<SlotPage*>& page : m_slot_pages)
+		{
+			delete page.load(std::memory_order_relaxed);
+		}
+	}
+
+	// Get a reference to a poly with the given PolyID or create one if needed.
+	Ref GetPoly(PolyID id, TypeID initial_types = TypeID{})
+	{
+		Shard& shard = GetShard(id);
+
+		// Most calls find an existing poly so try with only a shared lock first
+		{
+			std::shared_lock lock(shard.mutex);
+
+			auto it = shard.entries.find(id);
+
+			if (it != shard.entries.end())
+			{
+				return Ref(&*it);
+			}
+		}
+
+		std::lock_guard lock(shard.mutex);
+
+		auto&& [it, created] = shard.entries.try_emplace(id);
+
+		PolyEntry& entry = it->second;
+
+		if (created)
+		{
+			std::lock_guard archetype_lock(m_archetype_mutex);
+
+			entry.shard = &shard;
+
+			AllocateSlot(*it);
+			entry.type_id = initial_types | Archetype::CreateTypeID<Header>();
+			entry.data = AllocatePoly(*it, entry.type_id);
+
+			DEBUG_ASSERT(entry.type_id == entry.data.archetype->GetID(), "The archetype we got doesn't have the right type");
+
+			ConstructPoly(entry.data);
+		}
+
+		return Ref(&*it);
+	}
+
+	// Update the type of a poly to a new type. Any components that are in both
+	// will be moved while the rest will be destroyed/newly constructed.
+	void SetTypes(PolyID id, TypeID new_type_id)
+	{
+		Shard& shard = GetShard(id);
+
+		// The shard lock only keeps the entry alive while the archetype lock guards the poly data
+		std::shared_lock lock(shard.mutex);
+
+		auto it = shard.entries.find(id);
+
+		if (it == shard.entries.end())
+		{
+			return;
+		}
+
+		std::lock_guard archetype_lock(m_archetype_mutex);
+
+		new_type_id |= Archetype::CreateTypeID<Header>();
+
+		UpdatePolyType(*it, new_type_id);
+	}
+
+	// Add new components if they don't already exist to a poly.
+	// The existing components will be moved.
+	void AddTypes(PolyID id, TypeID new_types)
+	{
+		Shard& shard = GetShard(id);
+
+		std::shared_lock lock(shard.mutex);
+
+		auto it = shard.entries.find(id);
+
+		if (it == shard.entries.end())
+		{
+			return;
+		}
+
+		std::lock_guard archetype_lock(m_archetype_mutex);
+
+		TypeID new_type_id = it->second.type_id | new_types;
+		
+		UpdatePolyType(*it, new_type_id);
+	}
+
+	// Update the type of many polys at once. Polys that share an archetype are moved together
+	// one component at a time which is much cheaper than calling SetTypes for each poly.
+	void SetTypes(Span<PolyID> ids, TypeID new_type_id)
+	{
+		UpdatePolyTypes(ids, TypeID(), new_type_id | Archetype::CreateTypeID<Header>());
+	}
+
+	// Add new components to many polys at once. Polys that share an archetype are moved together
+	// one component at a time which is much cheaper than calling AddTypes for each poly.
+	void AddTypes(Span<PolyID> ids, TypeID new_types)
+	{
+		UpdatePolyTypes(ids, ~TypeID(), new_types);
+	}
+
+	// Iterate over all polys that have the given components. None of them can be chunked, use IterateChunks for those.
+	void Iterate(TypeID types, cb::Callback<void(Ptr)> callback) const
+	{
+		std::shared_lock lock(m_archetype_mutex);
+
+		ArchetypeList archetypes;
+		GetMatchingArchetypes(types, archetypes);
+
+		IteratePolys(archetypes, callback);
+	}
+
+	// Iterate over all polys that have the given components. Do only part
+	// of the work for the current worker. None of them can be chunked, use WorkerIterateChunks for those.
+	void WorkerIterate(TypeID types, size_t worker_count, size_t worker_index, cb::Callback<void(Ptr)> callback) const
+	{
+		std::shared_lock lock(m_archetype_mutex);
+
+		ArchetypeList archetypes;
+		GetMatchingArchetypes(types, archetypes);
+
+		WorkerIteratePolys(archetypes, worker_count, worker_index, callback);
+	}
+
+	// Iterate over every chunk of polys that have the given components.
+	// Only archetypes that use chunked storage are visited.
+	void IterateChunks(TypeID types, cb::Callback<void(ChunkView)> callback) const
+	{
+		std::shared_lock lock(m_archetype_mutex);
+
+		ArchetypeList archetypes;
+		GetMatchingArchetypes(types, archetypes);
+
+		IterateChunkRows(archetypes, callback);
+	}
+
+	// Iterate over every chunk of polys that have the given components. Do only
+	// part of the work for the current worker.
+	void WorkerIterateChunks(TypeID types, size_t worker_count, size_t worker_index, cb::Callback<void(ChunkView)> callback) const
+	{
+		std::shared_lock lock(m_archetype_mutex);
+
+		ArchetypeList archetypes;
+		GetMatchingArchetypes(types, archetypes);
+
+		WorkerIterateChunkRows(archetypes, worker_count, worker_index, callback);
+	}
+
+	// Create a query that caches which archetypes match it. The query lives as long as the factory.
+	const Query& AddQuery(TypeID required, TypeID excluded = TypeID{})
+	{
+		std::lock_guard lock(m_archetype_mutex);
+
+		Query& query = *m_queries.emplace_back(std::make_unique<Query>(required, excluded));
+
+		for (auto&& [type_id, entry] : m_archetypes)
+		{
+			if (query.Matches(type_id))
+			{
+				query.m_archetypes.push_back(&entry);
+			}
+		}
+
+		return query;
+	}
+
+	// Iterate over all polys that match the query. None of them can be chunked, use IterateChunks for those.
+	void Iterate(const Query& query, cb::Callback<void(Ptr)> callback) const
+	{
+		std::shared_lock lock(m_archetype_mutex);
+
+		IteratePolys(query.m_archetypes, callback);
+	}
+
+	// Iterate over all polys that match the query. Do only part of the work for the
+	// current worker with the polys split evenly between workers.
+	void WorkerIterate(const Query& query, size_t worker_count, size_t worker_index, cb::Callback<void(Ptr)> callback) const
+	{
+		std::shared_lock lock(m_archetype_mutex);
+
+		WorkerIteratePolys(query.m_archetypes, worker_count, worker_index, callback);
+	}
+
+	// Iterate over every chunk of polys that match the query
+	void IterateChunks(const Query& query, cb::Callback<void(ChunkView)> callback) const
+	{
+		std::shared_lock lock(m_archetype_mutex);
+
+		IterateChunkRows(query.m_archetypes, callback);
+	}
+
+	// Iterate over the chunks of polys that match the query. Do only part of the work for the
+	// current worker with the polys split evenly between workers.
+	void WorkerIterateChunks(const Query& query, size_t worker_count, size_t worker_index, cb::Callback<void(ChunkView)> callback) const
+	{
+		std::shared_lock lock(m_archetype_mutex);
+
+		WorkerIterateChunkRows(query.m_archetypes, worker_count, worker_index, callback);
+	}
+
+	// Update the type of a poly to a new type. Any components that are in both
+	// will be moved while the rest will be destroyed/newly constructed.
+	template<class... Types>
+	void SetTypes(PolyID id)
+	{
+		SetTypes(id, Archetype::CreateTypeID<Types...>());
+	}
+
+	// Add new components if they don't already exist to a poly.
+	// The existing components will be moved.
+	template<class... Types>
+	void AddTypes(PolyID id)
+	{
+		AddTypes(id, Archetype::CreateTypeID<Types...>());
+	}
+
+	// Update the type of many polys at once
+	template<class... Types>
+	void SetTypes(Span<PolyID> ids)
+	{
+		SetTypes(ids, Archetype::CreateTypeID<Types...>());
+	}
+
+	// Add new components to many polys at once
+	template<class... Types>
+	void AddTypes(Span<PolyID> ids)
+	{
+		AddTypes(ids, Archetype::CreateTypeID<Types...>());
+	}
+
+	// Iterate over all polys that have the given components
+	template<class... Types>
+	void Iterate(cb::Callback<void(Ptr)> callback) const
+	{
+		Iterate(Archetype::CreateTypeID<Types...>(), callback);
+	}
+
+	// Iterate over all polys that have the given components. Do only part
+	// of the work for the current worker.
+	template<class... Types>
+	void WorkerIterate(size_t worker_count, size_t worker_index, cb::Callback<void(Ptr)> callback) const
+	{
+		WorkerIterate(Archetype::CreateTypeID<Types...>(), worker_count, worker_index, callback);
+	}
+
+	// Iterate over every chunk of polys that have the given components
+	template<class... Types>
+	void IterateChunks(cb::Callback<void(ChunkView)> callback) const
+	{
+		IterateChunks(Archetype::CreateTypeID<Types...>(), callback);
+	}
+
+	// Iterate over every chunk of polys that have the given components. Do only
+	// part of the work for the current worker.
+	template<class... Types>
+	void WorkerIterateChunks(size_t worker_count, size_t worker_index, cb::Callback<void(ChunkView)> callback) const
+	{
+		WorkerIterateChunks(Archetype::CreateTypeID<Types...>(), worker_count, worker_index, callback);
+	}
+
+	// Iterate over the polys that wrote the component after the given tick. Polys that
+	// don't track the component are always visited since we can't tell if they changed.
+	template<class T>
+	void IterateChanged(uint32_t since_tick, cb::Callback<void(WeakRef)> callback) const
+	{
+		std::shared_lock lock(m_archetype_mutex);
+
+		const size_t index = Archetype::k_type_index<T>;
+
+		ArchetypeList archetypes;
+		GetMatchingArchetypes(Archetype::CreateTypeID<T>(), archetypes);
+
+		for (const ArchetypeEntry* entry : archetypes)
+		{
+			if (entry->archetype.GetStorage() == PolyStorage::Individual)
+			{
+				for (PolyMapEntry* poly : entry->owners)
+				{
+					callback(WeakRef(poly));
+				}
+
+				continue;
+			}
+
+			for (const std::unique_ptr<Chunk>& chunk : entry->chunks)
+			{
+				const uint32_t* ticks = entry->archetype.GetChangeTicks(*chunk, index);
+
+				// Skip whole chunks that haven't changed
+				if (ticks != nullptr && entry->archetype.GetChunkChangeTick(*chunk, index) <= since_tick)
+				{
+					continue;
+				}
+
+				PolyMapEntry** entries = GetChunkEntries(entry->archetype, *chunk);
+
+				for (uint32_t row = 0; row < chunk->count; row++)
+				{
+					if (ticks == nullptr || ticks[row] > since_tick)
+					{
+						callback(WeakRef(entries[row]));
+					}
+				}
+			}
+		}
+	}
+
+	// Create a query for polys that have all of the given types
+	template<class... Types>
+	const Query& AddQuery()
+	{
+		return AddQuery(Archetype::CreateTypeID<Types...>());
+	}
+
+	// Store archetypes that have all of the given types in chunks instead of individually.
+	// Only archetypes created after this call are affected and all their components need to be movable.
+	template<class... Types>
+	void UseChunkedStorage()
+	{
+		UseChunkedStorage(Archetype::CreateTypeID<Types...>());
+	}
+
+	void UseChunkedStorage(TypeID types)
+	{
+		std::lock_guard lock(m_archetype_mutex);
+
+		m_chunked_types.push_back(types);
+	}
+
+	// Track which polys write the given components so systems can find the ones that changed since a tick.
+	// Archetypes with tracked components use chunked storage. Only archetypes created after this call are affected.
+	template<class... Types>
+	void TrackChanges()
+	{
+		(TrackChanges(Archetype::CreateTypeID<Types>()), ...);
+	}
+
+	void TrackChanges(TypeID types)
+	{
+		std::lock_guard lock(m_archetype_mutex);
+
+		m_tracked_types |= types;
+
+		for (size_t i = 0; i < types.size(); i++)
+		{
+			if (types.test(i))
+			{
+				TypeID type;
+				type.set(i);
+
+				m_chunked_types.push_back(type);
+			}
+		}
+	}
+
+	// The tick that writes are marked with. Ticks start at 1 so every change happens after tick 0
+	uint32_t GetChangeTick() const
+	{
+		return m_change_tick.load(std::memory_order_relaxed);
+	}
+
+	// Start a new change tick. Usually called once per frame after everything has been updated
+	uint32_t AdvanceChangeTick()
+	{
+		return m_change_tick.fetch_add(1, std::memory_order_relaxed) + 1;
+	}
+
+	// Lay out the archetype with exactly the types of StaticT in the order of StaticT so that it can
+	// access the components with constant offsets. Should be called before the archetype is created.
+	template<class StaticT>
+	void UseStaticType()
+	{
+		std::lock_guard lock(m_archetype_mutex);
+
+		DEBUG_ASSERT(!m_archetypes.contains(StaticT::GetID()), "The archetype has already been laid out");
+
+		m_static_types.insert_or_assign(StaticT::GetID(), &StaticT::InitType);
+	}
+
+	template<class... Types>
+	void AddCallback(PolyEvent event, EventCallback callback)
+	{
+		AddCallback(Archetype::CreateTypeID<Types...>(), event, callback);
+	}
+
+	void AddCallback(TypeID types, PolyEvent event, EventCallback callback)
+	{
+		std::lock_guard lock(m_archetype_mutex);
+
+		// Add to future archetypes
+		m_callbacks[types].push_back({ event, callback });
+
+		// Add to existing archetypes
+		for (auto&& [type_id, entry] : m_archetypes)
+		{
+			if ((type_id & types) == types)
+			{
+				entry.archetype.AddCallback(event, callback);
+			}
+		}
+	}
+
+	template<class... Types>
+	void AddBatchCallback(PolyEvent event, BatchEventCallback callback)
+	{
+		AddBatchCallback(Archetype::CreateTypeID<Types...>(), event, callback);
+	}
+
+	// Add a callback that receives runs of polys of one archetype when the event is done in batches
+	void AddBatchCallback(TypeID types, PolyEvent event, BatchEventCallback callback)
+	{
+		std::lock_guard lock(m_archetype_mutex);
+
+		// Add to future archetypes
+		m_batch_callbacks[types].push_back({ event, callback });
+
+		// Add to existing archetypes
+		for (auto&& [type_id, entry] : m_archetypes)
+		{
+			if ((type_id & types) == types)
+			{
+				entry.archetype.AddBatchCallback(event, callback);
+			}
+		}
+	}
+
+	// Get the poly a handle points to or an empty ref if the poly was destroyed.
+	// Like a WeakRef this isn't safe to call while Cleanup is running.
+	WeakRef Resolve(Handle handle) const
+	{
+		size_t page_index = handle.slot >> k_slot_page_bits;
+
+		if (handle.generation == 0 || page_index >= k_max_slot_pages)
+		{
+			return WeakRef();
+		}
+
+		const SlotPage* page = m_slot_pages[page_index].load(std::memory_order_acquire);
+
+		if (page == nullptr)
+		{
+			return WeakRef();
+		}
+
+		const Slot& slot = (*page)[handle.slot & (k_slot_page_size - 1)];
+
+		if (slot.generation.load(std::memory_order_acquire) != handle.generation)
+		{
+			return WeakRef();
+		}
+
+		return WeakRef(slot.entry.load(std::memory_order_acquire));
+	}
+
+	bool IsValid(Handle handle) const
+	{
+		return Resolve(handle);
+	}
+
+	// Create a poly as a copy of the prefab. If a poly with the id already exists it is returned unchanged.
+	Ref Instantiate(const Prefab& prefab, PolyID id)
+	{
+		std::vector<Ref> polys;
+
+		Instantiate(prefab, Span<PolyID>(&id, 1), polys);
+
+		return std::move(polys.front());
+	}
+
+	// Create many polys at once as copies of the prefab. A reference to the poly of each id is added to
+	// polys_out in the same order. Polys with ids that already exist are returned unchanged and only the
+	// newly created polys are added to created_out when it is given.
+	void Instantiate(const Prefab& prefab, Span<PolyID> ids, std::vector<Ref>& polys_out, std::vector<WeakRef>* created_out = nullptr)
+	{
+		std::array<bool, k_num_shards> used_shards = {};
+
+		for (const PolyID& id : ids)
+		{
+			used_shards[GetShardIndex(id)] = true;
+		}
+
+		// Lock the shards in order so that we can't deadlock with another batch
+		std::array<std::unique_lock<tkrzw::SpinSharedMutex>, k_num_shards> locks;
+
+		for (size_t i = 0; i < k_num_shards; i++)
+		{
+			if (used_shards[i])
+			{
+				locks[i] = std::unique_lock(m_shards[i].mutex);
+			}
+		}
+
+		std::lock_guard archetype_lock(m_archetype_mutex);
+
+		std::vector<PolyMapEntry*> polys;
+		polys.reserve(ids.Size());
+
+		polys_out.reserve(polys_out.size() + ids.Size());
+
+		for (const PolyID& id : ids)
+		{
+			auto&& [it, created] = GetShard(id).entries.try_emplace(id);
+
+			if (created)
+			{
+				polys.push_back(&*it);
+
+				if (created_out)
+				{
+					created_out->push_back(WeakRef(&*it));
+				}
+			}
+
+			polys_out.push_back(Ref(&*it));
+		}
+
+		if (polys.empty())
+		{
+			return;
+		}
+
+		CreatePolys(GetArchetype(prefab.GetTypeID()), polys);
+
+		// Do one component at a time so each pass only touches one array in chunked storage
+		for (size_t i = 1; i < Archetype::k_num_types; i++)
+		{
+			const PolyTypeInfo& type_info = Archetype::k_type_info[i];
+
+			if (!prefab.m_type_id.test(i))
+			{
+				continue;
+			}
+
+			const std::byte* from = prefab.GetData(i);
+
+			if (type_info.trivial)
+			{
+				for (PolyMapEntry* poly : polys)
+				{
+					memcpy(GetComponentData(poly->second.data, i), from, type_info.size);
+				}
+			}
+			else
+			{
+				for (PolyMapEntry* poly : polys)
+				{
+					type_info.copy(from, GetComponentData(poly->second.data, i));
+				}
+			}
+		}
+	}
+
+	// Write every poly to the writer grouped by archetype. Each component is written as one array per archetype.
+	// Trivially copyable components are copied as raw bytes, components with a Serialize method write themselves
+	// and the rest are left out and default constructed when restoring. Polys shouldn't change while this runs.
+	void Snapshot(serialize::Writer& writer) const
+	{
+		std::array<std::shared_lock<tkrzw::SpinSharedMutex>, k_num_shards> locks;
+
+		for (size_t i = 0; i < k_num_shards; i++)
+		{
+			locks[i] = std::shared_lock(m_shards[i].mutex);
+		}
+
+		std::shared_lock archetype_lock(m_archetype_mutex);
+
+		writer.Write(k_snapshot_version);
+		writer.Write(m_archetypes.size());
+
+		std::vector<PolyMapEntry*> polys;
+
+		for (auto&& [type_id, entry] : m_archetypes)
+		{
+			polys.clear();
+
+			if (entry.archetype.GetStorage() == PolyStorage::Chunked)
+			{
+				for (const std::unique_ptr<Chunk>& chunk : entry.chunks)
+				{
+					PolyMapEntry** entries = GetChunkEntries(entry.archetype, *chunk);
+
+					polys.insert(polys.end(), entries, entries + chunk->count);
+				}
+			}
+			else
+			{
+				polys.insert(polys.end(), entry.owners.begin(), entry.owners.end());
+			}
+
+			// Polys that are waiting to be reclaimed don't have any references so leave them out
+			std::erase_if(polys, [](PolyMapEntry* poly)
+			{
+				return poly->second.refcount.load(std::memory_order_relaxed) == k_reclaim_queued;
+			});
+
+			writer.Write(type_id);
+			writer.Write(polys.size());
+
+			for (PolyMapEntry* poly : polys)
+			{
+				writer.Write(poly->first);
+			}
+
+			for (size_t i = 1; i < Archetype::k_num_types; i++)
+			{
+				const PolyTypeInfo& type_info = Archetype::k_type_info[i];
+
+				if (!type_id.test(i))
+				{
+					continue;
+				}
+
+				if (type_info.serialize != nullptr)
+				{
+					for (PolyMapEntry* poly : polys)
+					{
+						type_info.serialize(GetComponentData(poly->second.data, i), writer);
+					}
+				}
+				else if (type_info.trivial)
+				{
+					ForEachRowRun(polys, [&](PolyMapEntry* poly, size_t count)
+					{
+						writer.WriteBytes(GetComponentData(poly->second.data, i), type_info.size * count);
+					});
+				}
+			}
+		}
+	}
+
+	// Create the polys stored in a snapshot. Ids that already exist are skipped. References
+	// to the new polys are added to polys_out so that they aren't cleaned up straight away.
+	// Returns false if the snapshot was written by a different version or ends early. When it ends
+	// early the components of the polys that could not be read are default constructed
+	bool Restore(serialize::Reader& reader, std::vector<Ref>& polys_out)
+	{
+		size_t version;
+		reader.Read(version);
+
+		if (reader.HasFailed())
+		{
+			RUNTIME_PRINT_ERROR("The snapshot ended early");
+			return false;
+		}
+
+		if (version != k_snapshot_version)
+		{
+			RUNTIME_PRINT_ERROR("The snapshot was written by a different version");
+			return false;
+		}
+
+		std::array<std::unique_lock<tkrzw::SpinSharedMutex>, k_num_shards> locks;
+
+		for (size_t i = 0; i < k_num_shards; i++)
+		{
+			locks[i] = std::unique_lock(m_shards[i].mutex);
+		}
+
+		std::lock_guard archetype_lock(m_archetype_mutex);
+
+		size_t archetype_count;
+		reader.Read(archetype_count);
+
+		std::vector<PolyID> ids;
+		std::vector<PolyMapEntry*> polys;
+		std::vector<PolyMapEntry*> created_polys;
+
+		for (size_t archetype_index = 0; archetype_index < archetype_count; archetype_index++)
+		{
+			TypeID type_id;
+			size_t count;
+
+			reader.Read(type_id);
+			reader.Read(count);
+
+			if (reader.HasFailed())
+			{
+				break;
+			}
+
+			// Every poly takes at least its id so a larger count can only come from a corrupt snapshot
+			if (count > reader.Remaining() / sizeof(PolyID))
+			{
+				RUNTIME_PRINT_ERROR("The snapshot is corrupt");
+				return false;
+			}
+
+			ids.resize(count);
+
+			if (!reader.ReadBytes(ids.data(), count * sizeof(PolyID)))
+			{
+				break;
+			}
+
+			// Rows of ids that already exist stay null and their data is skipped
+			polys.assign(count, nullptr);
+			created_polys.clear();
+
+			for (size_t i = 0; i < count; i++)
+			{
+				auto&& [it, created] = GetShard(ids[i]).entries.try_emplace(ids[i]);
+
+				if (created)
+				{
+					polys[i] = &*it;
+					created_polys.push_back(&*it);
+					polys_out.push_back(Ref(&*it));
+				}
+			}
+
+			if (!created_polys.empty())
+			{
+				CreatePolys(GetArchetype(type_id), created_polys);
+			}
+
+			for (size_t i = 1; i < Archetype::k_num_types; i++)
+			{
+				const PolyTypeInfo& type_info = Archetype::k_type_info[i];
+
+				if (!type_id.test(i))
+				{
+					continue;
+				}
+
+				if (type_info.deserialize != nullptr)
+				{
+					for (PolyMapEntry* poly : polys)
+					{
+						if (poly != nullptr)
+						{
+							std::byte* data = GetComponentData(poly->second.data, i);
+
+							type_info.construct(data);
+							type_info.deserialize(data, reader);
+						}
+						else
+						{
+							// Read into a temporary component to skip over it
+							std::vector<std::max_align_t> skip((type_info.size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t));
+							std::byte* data = reinterpret_cast<std::byte*>(skip.data());
+
+							type_info.construct(data);
+							type_info.deserialize(data, reader);
+							type_info.destruct(data);
+						}
+					}
+				}
+				else if (type_info.trivial)
+				{
+					ForEachRowRun(polys, [&](PolyMapEntry* poly, size_t count)
+					{
+						if (poly != nullptr)
+						{
+							// Polys of a run follow each other so they can be constructed from the first one
+							if (!reader.ReadBytes(GetComponentData(poly->second.data, i), type_info.size * count))
+							{
+								for (size_t row = 0; row < count; row++)
+								{
+									type_info.construct(GetComponentData(poly->second.data, i) + type_info.size * row);
+								}
+							}
+						}
+						else
+						{
+							reader.Skip(type_info.size * count);
+						}
+					});
+				}
+				else
+				{
+					for (PolyMapEntry* poly : polys)
+					{
+						if (poly != nullptr)
+						{
+							type_info.construct(GetComponentData(poly->second.data, i));
+						}
+					}
+				}
+			}
+		}
+
+		if (reader.HasFailed())
+		{
+			RUNTIME_PRINT_ERROR("The snapshot ended early");
+			return false;
+		}
+
+		return true;
+	}
+
+	size_t GetCount() const
+	{
+		size_t count = 0;
+
+		for (const Shard& shard : m_shards)
+		{
+			std::shared_lock lock(shard.mutex);
+
+			count += shard.entries.size();
+		}
+
+		return count;
+	}
+
+	// Cleanup any polys that no longer have any references. Only the polys that were
+	// queued when their last reference was dropped are checked.
+	void Cleanup()
+	{
+		bool reclaimed;
+
+		// Destroying polys can drop the last reference to others so repeat until nothing new is queued
+		do
+		{
+			reclaimed = false;
+
+			for (Shard& shard : m_shards)
+			{
+				if (shard.reclaim_list.load(std::memory_order_relaxed) == nullptr)
+				{
+					continue;
+				}
+
+				std::lock_guard lock(shard.mutex);
+				std::lock_guard archetype_lock(m_archetype_mutex);
+
+				PolyMapEntry* poly = shard.reclaim_list.exchange(nullptr, std::memory_order_acquire);
+
+				while (poly != nullptr)
+				{
+					PolyMapEntry* next = poly->second.next_reclaim;
+
+					PolyEntry& entry = poly->second;
+
+					if (TryReclaim(entry))
+					{
+						DestructPoly(entry.data);
+
+						DeallocatePoly(entry.type_id, entry.data);
+
+						FreeSlot(entry);
+
+						shard.entries.erase(poly->first);
+
+						reclaimed = true;
+					}
+
+					poly = next;
+				}
+			}
+		}
+		while (reclaimed);
+	}
+
+	void DoEvent(PolyEvent event, WeakRef poly) const
+	{
+		poly.GetType()->DoEvent(event, poly);
+	}
+
+	// Do an event for polys that all share the same archetype
+	void DoBatchEvent(PolyEvent event, Span<WeakRef> polys) const
+	{
+		if (polys.Empty())
+		{
+			return;
+		}
+
+		const Archetype* archetype = polys[0].GetType();
+
+		DEBUG_ASSERT(std::all_of(polys.begin(), polys.end(), [archetype](WeakRef poly) { return poly.GetType() == archetype; }), "All polys in a batch should share an archetype");
+
+		archetype->DoBatchEvent(event, polys);
+	}
+
+private:
+	// Drop a reference to a poly. Dropping the last reference queues the poly to be reclaimed in Cleanup
+	static void Release(PolyMapEntry* poly)
+	{
+		PolyEntry& entry = poly->second;
+
+		size_t refcount = entry.refcount.load(std::memory_order_relaxed);
+		size_t new_refcount;
+
+		// The count and the queued flag change together so only one thread queues the poly. A poly that
+		// was referenced again while queued keeps the flag and is still in the list, so dropping its last
+		// reference again must not push it a second time
+		do
+		{
+			new_refcount = refcount == 1 ? k_reclaim_queued : refcount - 1;
+		}
+		while (!entry.refcount.compare_exchange_weak(refcount, new_refcount, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+		if (refcount == 1)
+		{
+			Shard& shard = *entry.shard;
+
+			PolyMapEntry* head = shard.reclaim_list.load(std::memory_order_relaxed);
+
+			do
+			{
+				entry.next_reclaim = head;
+			}
+			while (!shard.reclaim_list.compare_exchange_weak(head, poly, std::memory_order_release, std::memory_order_relaxed));
+		}
+	}
+
+	// Check if a queued poly can be destroyed. A poly that was referenced again since being
+	// queued is unqueued so that dropping its last reference will queue it again. The check and
+	// clearing the flag happen in one exchange so a release can't slip in between them
+	static bool TryReclaim(PolyEntry& entry)
+	{
+		size_t refcount = entry.refcount.load(std::memory_order_acquire);
+		size_t new_refcount;
+
+		do
+		{
+			DEBUG_ASSERT(refcount & k_reclaim_queued, "A poly in the reclaim list should be flagged as queued");
+
+			new_refcount = refcount == k_reclaim_queued ? 0 : refcount & ~k_reclaim_queued;
+		}
+		while (!entry.refcount.compare_exchange_weak(refcount, new_refcount, std::memory_order_acq_rel, std::memory_order_acquire));
+
+		return new_refcount == 0;
+	}
+
+	// Call the function for each run of polys that are in consecutive rows of the same chunk.
+	// Individually stored polys and missing polys are always in a run of their own.
+	template<class Func>
+	static void ForEachRowRun(const std::vector<PolyMapEntry*>& polys, Func&& func)
+	{
+		for (size_t begin = 0; begin < polys.size();)
+		{
+			size_t end = begin + 1;
+
+			if (polys[begin] != nullptr && polys[begin]->second.data.chunk != nullptr)
+			{
+				const PolyData& data = polys[begin]->second.data;
+
+				while (end < polys.size() && polys[end] != nullptr
+					&& polys[end]->second.data.chunk == data.chunk
+					&& polys[end]->second.data.row == data.row + (end - begin))
+				{
+					end++;
+				}
+			}
+
+			func(polys[begin], end - begin);
+
+			begin = end;
+		}
+	}
+
+	using ArchetypeList = GrowingSmallVector<const ArchetypeEntry*, 32>;
+
+	void GetMatchingArchetypes(TypeID types, ArchetypeList& archetypes) const
+	{
 		for (auto&& [type_id, entry] : m_archetypes)
 		{
-			if ((type_id & types) == types)
+			if ((type_id & types) == types)
+			{
+				archetypes.push_back(&entry);
+			}
+		}
+	}
+
+	static size_t GetChunkedCount(const ArchetypeEntry& entry)
+	{
+		if (entry.chunks.empty())
+		{
+			return 0;
+		}
+
+		return (entry.chunks.size() - 1) * entry.archetype.GetChunkCapacity() + entry.chunks.back()->count;
+	}
+
+	// Polys of chunked archetypes have no header to give as a Ptr. They have to be visited with the chunk iteration
+	template<class Archetypes>
+	static void CheckNoChunkedArchetypes(const Archetypes& archetypes)
+	{
+		DEBUG_ASSERT(std::none_of(archetypes.begin(), archetypes.end(), [](const ArchetypeEntry* entry)
+		{
+			return entry->archetype.GetStorage() == PolyStorage::Chunked;
+		}), "Chunked polys can't be iterated as Ptrs. Use IterateChunks instead");
+	}
+
+	template<class Archetypes>
+	static void IteratePolys(const Archetypes& archetypes, cb::Callback<void(Ptr)> callback)
+	{
+		CheckNoChunkedArchetypes(archetypes);
+
+		for (const ArchetypeEntry* entry : archetypes)
+		{
+			for (Ptr poly : entry->polys)
+			{
+				callback(poly);
+			}
+		}
+	}
+
+	// Visit the workers share of the polys. Work is split by poly count instead of by
+	// archetype so that workers get an even share even with few large archetypes
+	template<class Archetypes>
+	static void WorkerIteratePolys(const Archetypes& archetypes, size_t worker_count, size_t worker_index, cb::Callback<void(Ptr)> callback)
+	{
+		CheckNoChunkedArchetypes(archetypes);
+
+		size_t total = 0;
+
+		for (const ArchetypeEntry* entry : archetypes)
+		{
+			total += entry->polys.size();
+		}
+
+		const size_t begin = total * worker_index / worker_count;
+		const size_t end = total * (worker_index + 1) / worker_count;
+
+		size_t offset = 0;
+
+		for (const ArchetypeEntry* entry : archetypes)
+		{
+			if (offset >= end)
+			{
+				break;
+			}
+
+			const size_t count = entry->polys.size();
+			const size_t first = std::max(begin, offset);
+			const size_t last = std::min(end, offset + count);
+
+			for (size_t i = first; i < last; i++)
+			{
+				callback(entry->polys[i - offset]);
+			}
+
+			offset += count;
+		}
+	}
+
+	template<class Archetypes>
+	static void IterateChunkRows(const Archetypes& archetypes, cb::Callback<void(ChunkView)> callback)
+	{
+		for (const ArchetypeEntry* entry : archetypes)
+		{
+			for (const std::unique_ptr<Chunk>& chunk : entry->chunks)
+			{
+				callback(ChunkView(&entry->archetype, chunk.get()));
+			}
+		}
+	}
+
+	// Visit the workers share of the chunk rows. A chunk can be split between workers
+	template<class Archetypes>
+	static void WorkerIterateChunkRows(const Archetypes& archetypes, size_t worker_count, size_t worker_index, cb::Callback<void(ChunkView)> callback)
+	{
+		size_t total = 0;
+
+		for (const ArchetypeEntry* entry : archetypes)
+		{
+			total += GetChunkedCount(*entry);
+		}
+
+		const size_t begin = total * worker_index / worker_count;
+		const size_t end = total * (worker_index + 1) / worker_count;
+
+		size_t offset = 0;
+
+		for (const ArchetypeEntry* entry : archetypes)
+		{
+			const size_t archetype_count = GetChunkedCount(*entry);
+
+			// Skip whole archetypes before our range
+			if (offset + archetype_count <= begin)
+			{
+				offset += archetype_count;
+				continue;
+			}
+
+			for (const std::unique_ptr<Chunk>& chunk : entry->chunks)
+			{
+				if (offset >= end)
+				{
+					return;
+				}
+
+				const size_t count = chunk->count;
+				const size_t first = std::max(begin, offset);
+				const size_t last = std::min(end, offset + count);
+
+				if (first < last)
+				{
+					callback(ChunkView(&entry->archetype, chunk.get(), first - offset, last - offset));
+				}
+
+				offset += count;
+			}
+		}
+	}
+
+	Slot& GetSlot(uint32_t slot)
+	{
+		return (*m_slot_pages[slot >> k_slot_page_bits].load(std::memory_order_relaxed))[slot & (k_slot_page_size - 1)];
+	}
+
+	// Give a new poly a slot so that handles can find it. Requires the archetype lock
+	void AllocateSlot(PolyMapEntry& poly)
+	{
+		uint32_t slot_index;
+
+		if (!m_free_slots.empty())
+		{
+			slot_index = m_free_slots.back();
+			m_free_slots.pop_back();
+		}
+		else
+		{
+			slot_index = m_slot_count++;
+
+			// Checked in release builds too as running out would index past the page table
+			CRASH_COND_MSG((slot_index >> k_slot_page_bits) >= k_max_slot_pages, "We have run out of poly slots");
+
+			std::atomic<SlotPage*>& page = m_slot_pages[slot_index >> k_slot_page_bits];
+
+			if (page.load(std::memory_order_relaxed) == nullptr)
+			{
+				page.store(new SlotPage, std::memory_order_release);
+			}
+		}
+
+		Slot& slot = GetSlot(slot_index);
+
+		slot.entry.store(&poly, std::memory_order_release);
+
+		poly.second.slot = slot_index;
+		poly.second.generation = slot.generation.load(std::memory_order_relaxed);
+	}
+
+	// Move the polys slot to a new generation so that existing handles become invalid. Requires the archetype lock
+	void FreeSlot(PolyEntry& entry)
+	{
+		Slot& slot = GetSlot(entry.slot);
+
+		uint32_t generation = entry.generation + 1;
+
+		slot.entry.store(nullptr, std::memory_order_relaxed);
+		slot.generation.store(generation != 0 ? generation : 1, std::memory_order_release);
+
+		m_free_slots.push_back(entry.slot);
+	}
+
+	static size_t GetShardIndex(const PolyID& id)
+	{
+		// Fibonacci hashing spreads the bits of the hash into the top bits we use
+		uint64_t hash = static_cast<uint64_t>(robin_hood::hash<PolyID>{}(id)) * 0x9E3779B97F4A7C15ull;
+
+		return hash >> (64 - k_shard_bits);
+	}
+
+	Shard& GetShard(const PolyID& id)
+	{
+		return m_shards[GetShardIndex(id)];
+	}
+
+	void InitType(Archetype& archetype, TypeID type_id)
+	{
+		auto static_it = m_static_types.find(type_id);
+
+		if (static_it != m_static_types.end())
+		{
+			static_it->second(archetype);
+		}
+		else
+		{
+			for (size_t i = 1; i < type_id.size(); i++)
 			{
-				size_t len = entry.polys.end() - entry.polys.begin();
-				size_t len_per_worker = len / worker_count;
+				if (type_id.test(i))
+				{
+					archetype.AddType(i);
+				}
+			}
+		}
 
-				auto begin = entry.polys.begin() + (worker_index * len_per_worker);
-				auto end = entry.polys.end() + (worker_index * len_per_worker) + len_per_worker;
+		for (auto&& [types, entries] : m_callbacks)
+		{
+			if ((type_id & types) == types) // Do we have all the types that the entry requires
+			{
+				for (const CallbackEntry& entry : entries)
+				{
+					archetype.AddCallback(entry.event, entry.callback);
+				}
+			}
+		}
 
-				for (auto it = begin; it != end; it++)
+		for (auto&& [types, entries] : m_batch_callbacks)
+		{
+			if ((type_id & types) == types)
+			{
+				for (const BatchCallbackEntry& entry : entries)
 				{
-					callback(*it);
+					archetype.AddBatchCallback(entry.event, entry.callback);
 				}
 			}
 		}
-	}
 
-	// Update the type of a poly to a new type. Any components that are in both
-	// will be moved while the rest will be destroyed/newly constructed.
-	template<class... Types>
-	void SetTypes(PolyID id)
-	{
-		SetTypes(id, Archetype::CreateTypeID<Types...>());
+		for (TypeID types : m_chunked_types)
+		{
+			if ((type_id & types) == types)
+			{
+				archetype.InitChunks(m_tracked_types, &m_change_tick);
+				break;
+			}
+		}
 	}
 
-	// Add new components if they don't already exist to a poly.
-	// The existing components will be moved.
-	template<class... Types>
-	void AddTypes(PolyID id)
+	// Get the array of poly entries that is stored in the header array of a chunk
+	static PolyMapEntry** GetChunkEntries(const Archetype& archetype, Chunk& chunk)
 	{
-		AddTypes(id, Archetype::CreateTypeID<Types...>());
+		return reinterpret_cast<PolyMapEntry**>(archetype.GetColumn(chunk, 0));
 	}
 
-	// Iterate over all polys that have the given components
-	template<class... Types>
-	void Iterate(cb::Callback<void(Ptr)> callback) const
+	// Get the memory of a component of a poly or nullptr if the poly doesn't have the component
+	static std::byte* GetComponentData(const PolyData& data, size_t index)
 	{
-		Iterate(Archetype::CreateTypeID<Types...>(), callback);
-	}
+		uint16_t type_offset = data.archetype->m_type_offsets[index];
 
-	// Iterate over all polys that have the given components. Do only part
-	// of the work for the current worker.
-	template<class... Types>
-	void WorkerIterate(size_t worker_count, size_t worker_index, cb::Callback<void(Ptr)> callback) const
-	{
-		WorkerIterate(Archetype::CreateTypeID<Types...>(), worker_count, worker_index, callback);
+		if (type_offset == Archetype::k_invalid_offset)
+		{
+			return nullptr;
+		}
+
+		if (data.chunk != nullptr)
+		{
+			return data.archetype->GetColumn(*data.chunk, index) + Archetype::k_type_info[index].size * data.row;
+		}
+
+		return reinterpret_cast<std::byte*>(data.header) + type_offset;
 	}
 
-	template<class... Types>
-	void AddCallback(PolyEvent event, EventCallback callback)
+	static void ConstructPoly(const PolyData& data)
 	{
-		AddCallback(Archetype::CreateTypeID<Types...>(), event, callback);
+		if (data.chunk == nullptr)
+		{
+			data.archetype->ConstructPoly(data.header);
+			return;
+		}
+
+		for (size_t i = 1; i < Archetype::k_num_types; i++)
+		{
+			if (std::byte* ptr = GetComponentData(data, i))
+			{
+				Archetype::k_type_info[i].construct(ptr);
+			}
+		}
 	}
 
-	void AddCallback(TypeID types, PolyEvent event, EventCallback callback)
+	static void DestructPoly(const PolyData& data)
 	{
-		std::lock_guard lock(m_mutex);
-
-		// Add to future archetypes
-		m_callbacks[types].push_back({ event, callback });
+		if (data.chunk == nullptr)
+		{
+			data.archetype->DestructPoly(data.header);
+			return;
+		}
 
-		// Add to existing archetypes
-		for (auto&& [type_id, entry] : m_archetypes)
+		for (size_t i = 1; i < Archetype::k_num_types; i++)
 		{
-			if ((type_id & types) == types)
+			if (std::byte* ptr = GetComponentData(data, i))
 			{
-				entry.archetype.AddCallback(event, callback);
+				Archetype::k_type_info[i].destruct(ptr);
 			}
 		}
 	}
 
-	size_t GetCount() const
+	// Setup many new entries and allocate their polys together. The components aren't constructed.
+	void CreatePolys(ArchetypeEntry& entry, Span<PolyMapEntry*> polys)
 	{
-		std::shared_lock lock(m_mutex);
+		for (PolyMapEntry* poly : polys)
+		{
+			PolyEntry& poly_entry = poly->second;
+
+			poly_entry.shard = &GetShard(poly->first);
+			poly_entry.type_id = entry.archetype.GetID();
 
-		return m_entries.size();
+			AllocateSlot(*poly);
+		}
+
+		AllocatePolys(entry, polys);
 	}
 
-	// Cleanup any polys that no longer have any references
-	void Cleanup()
+	// Get the archetype with the given types and create it if it doesn't exist yet
+	ArchetypeEntry& GetArchetype(TypeID type_id)
 	{
-		std::lock_guard lock(m_mutex);
-
-		for (auto it = m_entries.begin(); it != m_entries.end();)
-		{
-			PolyEntry& entry = it->second;
+		auto&& [it, emplaced] = m_archetypes.try_emplace(type_id);
 
-			if (entry.refcount.load(std::memory_order_acquire) == 0)
-			{
-				entry.archetype->DestructPoly(entry.header);
+		ArchetypeEntry& entry = it->second;
 
-				DeallocatePoly(entry.type_id, entry.header);
+		if (emplaced)
+		{
+			InitType(entry.archetype, type_id);
 
-				it = m_entries.erase(it);
-			}
-			else
+			for (const std::unique_ptr<Query>& query : m_queries)
 			{
-				it++;
+				if (query->Matches(type_id))
+				{
+					query->m_archetypes.push_back(&entry);
+				}
 			}
 		}
+
+		return entry;
 	}
 
-	void DoEvent(PolyEvent event, WeakRef poly) const
+	// Allocate a new poly for the given archetype. The components aren't constructed.
+	PolyData AllocatePoly(PolyMapEntry& poly, TypeID type_id)
 	{
-		poly.GetType()->DoEvent(event, poly);
+		return AllocatePoly(poly, GetArchetype(type_id));
 	}
 
-private:
-	void InitType(Archetype& archetype, TypeID type_id)
+	PolyData AllocatePoly(PolyMapEntry& poly, ArchetypeEntry& entry)
 	{
-		for (size_t i = 1; i < type_id.size(); i++)
+		entry.refcount++;
+
+		PolyData data;
+		data.archetype = &entry.archetype;
+
+		if (entry.archetype.GetStorage() == PolyStorage::Chunked)
 		{
-			if (type_id.test(i))
+			if (entry.chunks.empty() || entry.chunks.back()->count == entry.archetype.GetChunkCapacity())
 			{
-				archetype.AddType(i);
+				entry.chunks.push_back(std::unique_ptr<Chunk>(new Chunk));
+				entry.chunks.back()->index = static_cast<uint32_t>(entry.chunks.size() - 1);
+
+				entry.archetype.InitChunk(*entry.chunks.back());
 			}
+
+			data.chunk = entry.chunks.back().get();
+			data.row = data.chunk->count++;
+
+			// New rows count as changed so that systems looking for changes see new polys
+			entry.archetype.MarkRowChanged(*data.chunk, data.row);
+
+			GetChunkEntries(entry.archetype, *data.chunk)[data.row] = &poly;
+		}
+		else
+		{
+			data.header = entry.archetype.AllocatePoly();
+			data.row = static_cast<uint32_t>(entry.polys.size());
+
+			entry.polys.push_back(data.header);
+			entry.owners.push_back(&poly);
 		}
 
-		for (auto&& [types, entries] : m_callbacks)
+		return data;
+	}
+
+	// Allocate the polys of many entries at once. Chunked archetypes create all the chunks they need up front and
+	// fill them in order. The components aren't constructed.
+	void AllocatePolys(ArchetypeEntry& entry, Span<PolyMapEntry*> polys)
+	{
+		if (entry.archetype.GetStorage() != PolyStorage::Chunked)
 		{
-			if ((type_id & types) == types) // Do we have all the types that the entry requires
+			entry.polys.reserve(entry.polys.size() + polys.Size());
+			entry.owners.reserve(entry.owners.size() + polys.Size());
+
+			for (PolyMapEntry* poly : polys)
 			{
-				for (const CallbackEntry& entry : entries)
-				{
-					archetype.AddCallback(entry.event, entry.callback);
-				}
+				poly->second.data = AllocatePoly(*poly, entry);
 			}
+
+			return;
 		}
-	}
 
-	// Allocate a new poly for the given archetype.
-	Header* AllocatePoly(TypeID type_id)
-	{
-		auto&& [it, emplaced] = m_archetypes.try_emplace(type_id);
+		const uint32_t capacity = entry.archetype.GetChunkCapacity();
 
-		ArchetypeEntry& entry = it->second;
+		const size_t free_rows = entry.chunks.empty() ? 0 : capacity - entry.chunks.back()->count;
+		const size_t new_chunks = polys.Size() > free_rows ? (polys.Size() - free_rows + capacity - 1) / capacity : 0;
 
-		if (emplaced)
+		// Start filling the last chunk if it has room, otherwise the first new one
+		size_t chunk_index = free_rows > 0 ? entry.chunks.size() - 1 : entry.chunks.size();
+
+		entry.chunks.reserve(entry.chunks.size() + new_chunks);
+
+		for (size_t i = 0; i < new_chunks; i++)
 		{
-			InitType(entry.archetype, type_id);
+			entry.chunks.push_back(std::unique_ptr<Chunk>(new Chunk));
+			entry.chunks.back()->index = static_cast<uint32_t>(entry.chunks.size() - 1);
+
+			entry.archetype.InitChunk(*entry.chunks.back());
 		}
 
-		entry.refcount++;
+		entry.refcount += polys.Size();
+
+		for (PolyMapEntry* poly : polys)
+		{
+			Chunk* chunk = entry.chunks[chunk_index].get();
+
+			if (chunk->count == capacity)
+			{
+				chunk = entry.chunks[++chunk_index].get();
+			}
 
-		Header* poly = entry.archetype.AllocatePoly();
+			PolyData& data = poly->second.data;
+			data.archetype = &entry.archetype;
+			data.chunk = chunk;
+			data.row = chunk->count++;
 
-		entry.polys.push_back(poly);
+			// New rows count as changed so that systems looking for changes see new polys
+			entry.archetype.MarkRowChanged(*chunk, data.row);
 
-		return poly;
+			GetChunkEntries(entry.archetype, *chunk)[data.row] = poly;
+		}
 	}
 
-	// Deallocate a poly for the given archetype.
-	void DeallocatePoly(TypeID id, Header* poly)
+	// Deallocate a poly for the given archetype. The components should already be destructed or moved.
+	void DeallocatePoly(TypeID id, const PolyData& data)
 	{
 		auto it = m_archetypes.find(id);
 
 		ArchetypeEntry& entry = it->second;
 
-		entry.polys.erase(std::remove(entry.polys.begin(), entry.polys.end(), poly), entry.polys.end());
+		if (data.chunk != nullptr)
+		{
+			Chunk& last_chunk = *entry.chunks.back();
+			uint32_t last_row = last_chunk.count - 1;
+
+			// Move the last poly into the gap so that the chunks stay packed
+			if (&last_chunk != data.chunk || last_row != data.row)
+			{
+				PolyMapEntry* last = GetChunkEntries(entry.archetype, last_chunk)[last_row];
+
+				for (size_t i = 1; i < Archetype::k_num_types; i++)
+				{
+					if (std::byte* from = GetComponentData(last->second.data, i))
+					{
+						Archetype::k_type_info[i].move(from, GetComponentData(data, i));
+						Archetype::k_type_info[i].destruct(from);
+					}
+				}
+
+				GetChunkEntries(entry.archetype, *data.chunk)[data.row] = last;
+
+				entry.archetype.MoveRowTicks(last_chunk, last_row, *data.chunk, data.row);
+
+				last->second.data.chunk = data.chunk;
+				last->second.data.row = data.row;
+			}
+
+			last_chunk.count--;
+
+			if (last_chunk.count == 0)
+			{
+				entry.chunks.pop_back();
+			}
+		}
+		else
+		{
+			uint32_t last_row = static_cast<uint32_t>(entry.polys.size() - 1);
+
+			// Move the last poly into the gap so removing is constant time
+			if (last_row != data.row)
+			{
+				PolyMapEntry* last = entry.owners[last_row];
+
+				entry.polys[data.row] = entry.polys[last_row];
+				entry.owners[data.row] = last;
+
+				last->second.data.row = data.row;
+			}
+
+			entry.polys.pop_back();
+			entry.owners.pop_back();
 
-		entry.archetype.DeallocatePoly(poly);
+			entry.archetype.DeallocatePoly(data.header);
+		}
 
 		entry.refcount--;
 
 		if (entry.refcount == 0)
 		{
+			for (const std::unique_ptr<Query>& query : m_queries)
+			{
+				if (query->Matches(id))
+				{
+					unordered_erase(query->m_archetypes, &entry);
+				}
+			}
+
 			m_archetypes.erase(it);
 		}
 	}
 
 	// Change a polys type and create/destroy components as needed.
-	Header* UpdatePolyType(Header* old_poly, TypeID old_type_id, TypeID new_type_id)
+	void UpdatePolyType(PolyMapEntry& poly, TypeID new_type_id)
 	{
-		if (new_type_id == old_type_id)
+		PolyEntry& poly_entry = poly.second;
+
+		if (new_type_id == poly_entry.type_id)
 		{
-			return old_poly;
+			return;
 		}
 
-		Header* new_poly = AllocatePoly(new_type_id);
+		TypeID old_type_id = poly_entry.type_id;
+		PolyData old_data = poly_entry.data;
+		PolyData new_data = AllocatePoly(poly, new_type_id);
 
-		DEBUG_ASSERT(new_poly->archetype != old_poly->archetype, "The archetypes should be different");
+		DEBUG_ASSERT(new_data.archetype != old_data.archetype, "The archetypes should be different");
 
 		for (size_t i = 1; i < Archetype::k_num_types; i++)
 		{
-			uint16_t old_type_offset = old_poly->archetype->m_type_offsets[i];
-			uint16_t new_type_offset = new_poly->archetype->m_type_offsets[i];
+			std::byte* from = GetComponentData(old_data, i);
+			std::byte* to = GetComponentData(new_data, i);
 
-			if (old_type_offset != Archetype::k_invalid_offset)
+			if (from != nullptr)
 			{
-				if (new_type_offset != Archetype::k_invalid_offset)
+				if (to != nullptr)
 				{
-					std::byte* from = (std::byte*)old_poly + old_type_offset;
-					std::byte* to = (std::byte*)new_poly + new_type_offset;
-
 					Archetype::k_type_info[i].move(from, to);
 				}
-				else
+
+				Archetype::k_type_info[i].destruct(from);
+			}
+			else if (to != nullptr)
+			{
+				Archetype::k_type_info[i].construct(to);
+			}
+		}
+
+		poly_entry.type_id = new_type_id;
+		poly_entry.data = new_data;
+
+		DeallocatePoly(old_type_id, old_data);
+	}
+
+	// Change the type of many polys. Each new type is the old type masked by keep_types plus new_types.
+	void UpdatePolyTypes(Span<PolyID> ids, TypeID keep_types, TypeID new_types)
+	{
+		std::array<bool, k_num_shards> used_shards = {};
+
+		for (const PolyID& id : ids)
+		{
+			used_shards[GetShardIndex(id)] = true;
+		}
+
+		// Lock the shards in order so that we can't deadlock with another batch
+		std::array<std::shared_lock<tkrzw::SpinSharedMutex>, k_num_shards> locks;
+
+		for (size_t i = 0; i < k_num_shards; i++)
+		{
+			if (used_shards[i])
+			{
+				locks[i] = std::shared_lock(m_shards[i].mutex);
+			}
+		}
+
+		std::vector<PolyMapEntry*> polys;
+		polys.reserve(ids.Size());
+
+		for (const PolyID& id : ids)
+		{
+			Shard& shard = GetShard(id);
+
+			auto it = shard.entries.find(id);
+
+			if (it != shard.entries.end())
+			{
+				polys.push_back(&*it);
+			}
+		}
+
+		// Ignore ids that were given more than once
+		std::sort(polys.begin(), polys.end());
+		polys.erase(std::unique(polys.begin(), polys.end()), polys.end());
+
+		std::lock_guard archetype_lock(m_archetype_mutex);
+
+		robin_hood::unordered_map<TypeID, std::vector<PolyMapEntry*>> groups;
+
+		for (PolyMapEntry* poly : polys)
+		{
+			groups[poly->second.type_id].push_back(poly);
+		}
+
+		for (auto&& [old_type_id, group] : groups)
+		{
+			TypeID new_type_id = (old_type_id & keep_types) | new_types;
+
+			if (new_type_id != old_type_id)
+			{
+				MovePolys(group, old_type_id, new_type_id);
+			}
+		}
+	}
+
+	// Move polys that all have the same archetype to another archetype
+	void MovePolys(const std::vector<PolyMapEntry*>& polys, TypeID old_type_id, TypeID new_type_id)
+	{
+		ArchetypeEntry& new_entry = GetArchetype(new_type_id);
+
+		std::vector<PolyData> old_data;
+		old_data.reserve(polys.size());
+
+		for (PolyMapEntry* poly : polys)
+		{
+			old_data.push_back(poly->second.data);
+
+			poly->second.type_id = new_type_id;
+			poly->second.data = AllocatePoly(*poly, new_entry);
+		}
+
+		// Do one component at a time so each pass only touches one array in chunked storage
+		for (size_t i = 1; i < Archetype::k_num_types; i++)
+		{
+			const PolyTypeInfo& type_info = Archetype::k_type_info[i];
+
+			if (old_type_id.test(i) && new_type_id.test(i))
+			{
+				for (size_t j = 0; j < polys.size(); j++)
 				{
-					std::byte* from = (std::byte*)old_poly + old_type_offset;
+					std::byte* from = GetComponentData(old_data[j], i);
 
-					Archetype::k_type_info[i].destruct(from);
+					type_info.move(from, GetComponentData(polys[j]->second.data, i));
+					type_info.destruct(from);
 				}
 			}
-			else if (new_type_offset != Archetype::k_invalid_offset)
+			else if (old_type_id.test(i))
 			{
-				std::byte* to = (std::byte*)new_poly + new_type_offset;
-
-				Archetype::k_type_info[i].construct(to);
+				for (const PolyData& data : old_data)
+				{
+					type_info.destruct(GetComponentData(data, i));
+				}
+			}
+			else if (new_type_id.test(i))
+			{
+				for (PolyMapEntry* poly : polys)
+				{
+					type_info.construct(GetComponentData(poly->second.data, i));
+				}
 			}
 		}
 
-		DeallocatePoly(old_type_id, old_poly);
+		// Free the old rows from last to first so that the poly swapped into each gap is never one we are moving
+		std::sort(old_data.begin(), old_data.end(), [](const PolyData& lhs, const PolyData& rhs)
+		{
+			uint32_t lhs_chunk = lhs.chunk ? lhs.chunk->index : 0;
+			uint32_t rhs_chunk = rhs.chunk ? rhs.chunk->index : 0;
+
+			return lhs_chunk != rhs_chunk ? lhs_chunk > rhs_chunk : lhs.row > rhs.row;
+		});
 
-		return new_poly;
+		for (const PolyData& data : old_data)
+		{
+			DeallocatePoly(old_type_id, data);
+		}
 	}
 
 private:
+	std::array<AlignedData<Shard>, k_num_shards> m_shards;
+
+	// Guards the archetypes and the memory of every poly. Always locked after a shard lock
+	mutable tkrzw::SpinSharedMutex m_archetype_mutex;
+
 	ArchetypeMap m_archetypes;
 
-	PolyMap m_entries;
+	// Guarded by the archetype lock except for reading the slots
+	std::array<std::atomic<SlotPage*>, k_max_slot_pages> m_slot_pages = {};
+	std::vector<uint32_t> m_free_slots;
+	uint32_t m_slot_count = 0;
 
 	// Callbacks that will be added to archetypes based on what types they have
 	robin_hood::unordered_map<TypeID, CallbackEntries> m_callbacks;
+	robin_hood::unordered_map<TypeID, BatchCallbackEntries> m_batch_callbacks;
+
+	// Archetypes that have any of these sets of types use chunked storage
+	std::vector<TypeID> m_chunked_types;
+
+	// Components that record the tick they were written in
+	TypeID m_tracked_types;
+	std::atomic_uint32_t m_change_tick = 1;
+
+	// Archetypes that are laid out by a StaticPolyType
+	robin_hood::unordered_map<TypeID, void(*)(Archetype&)> m_static_types;
 
-	mutable tkrzw::SpinSharedMutex m_mutex;
+	std::vector<std::unique_ptr<Query>> m_queries;
 };
\ No newline at end of file
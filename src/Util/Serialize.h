@@ -3,6 +3,7 @@
 #include "Util.h"
 
 #include <string>
+#include <cstring>
 
 namespace serialize
 {
@@ -14,19 +15,71 @@ namespace serialize
 			m_pos(0)
 		{}
 
+		// Reading past the end of the buffer fails the reader and value initializes the object
 		template<class T>
 		void Read(T& object)
 		{
-			std::string_view data = m_buffer.substr(m_pos, sizeof(T));
+			if (!CanRead(sizeof(T)))
+			{
+				object = T();
+				return;
+			}
 
-			object = *reinterpret_cast<const T*>(data.data());
+			object = *reinterpret_cast<const T*>(m_buffer.data() + m_pos);
 
 			m_pos += sizeof(T);
 		}
 
+		// Read raw bytes straight into memory. Returns false without reading anything if there aren't enough bytes
+		bool ReadBytes(void* data, size_t size)
+		{
+			if (!CanRead(size))
+			{
+				return false;
+			}
+
+			memcpy(data, m_buffer.data() + m_pos, size);
+
+			m_pos += size;
+
+			return true;
+		}
+
+		void Skip(size_t size)
+		{
+			if (CanRead(size))
+			{
+				m_pos += size;
+			}
+		}
+
+		// How many bytes are left to read
+		size_t Remaining() const
+		{
+			return m_buffer.size() - m_pos;
+		}
+
+		// Set once a read went past the end of the buffer. Nothing more is read after that
+		bool HasFailed() const
+		{
+			return m_failed;
+		}
+
+	private:
+		bool CanRead(size_t size)
+		{
+			if (m_failed || size > m_buffer.size() - m_pos)
+			{
+				m_failed = true;
+			}
+
+			return !m_failed;
+		}
+
 	private:
 		std::string_view m_buffer;
 		size_t m_pos;
+		bool m_failed = false;
 	};
 
 	class Writer
@@ -44,6 +97,13 @@ namespace serialize
 			m_pos += sizeof(T);
 		}
 
+		// Write raw bytes from memory
+		void WriteBytes(const void* data, size_t size)
+		{
+			m_buffer.append(reinterpret_cast<const char*>(data), size);
+			m_pos += size;
+		}
+
 	private:
 		std::string& m_buffer;
 		size_t m_pos;
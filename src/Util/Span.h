@@ -164,7 +164,7 @@ public:
 
 	bool Empty() const
 	{
-		return m_size != 0;
+		return m_size == 0;
 	}
 
 	T* begin() const
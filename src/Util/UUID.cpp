@@ -123,6 +123,7 @@ UUID::UUID(const std::string& string) :
 	}
 }
 
+#if !defined(HEADLESS_BUILD)
 UUID::UUID(const godot::String& string) :
 	m_data{ 0, 0 }
 {
@@ -135,6 +136,7 @@ UUID::UUID(const godot::String& string) :
 		DEBUG_PRINT_ERROR("Failed to load uuid from string");
 	}
 }
+#endif
 
 bool UUID::operator==(const UUID& other) const
 {
@@ -156,6 +158,7 @@ std::string UUID::ToString() const
 	return std::string(buffer, 36);
 }
 
+#if !defined(HEADLESS_BUILD)
 // Get the uuid as a string
 godot::String UUID::ToGodotString() const
 {
@@ -165,6 +168,7 @@ godot::String UUID::ToGodotString() const
 
 	return godot::String::utf8(buffer, 36);
 }
+#endif
 
 UUID GenerateUUID()
 {
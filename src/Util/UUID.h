@@ -1,6 +1,8 @@
 #pragma once
 
+#if !defined(HEADLESS_BUILD)
 #include <godot_cpp/variant/string.hpp>
+#endif
 
 #include <string>
 #include <cstdint>
@@ -18,7 +20,9 @@ struct UUID
 
     // Initialize with a uuid in string form. If invalid then the uuid will have a value of 0
     explicit UUID(const std::string& string);
+#if !defined(HEADLESS_BUILD)
     explicit UUID(const godot::String& string);
+#endif
 
     bool operator==(const UUID& other) const;
     bool operator!=(const UUID& other) const;
@@ -26,8 +30,10 @@ struct UUID
     // Get the uuid as a string
     std::string ToString() const;
 
+#if !defined(HEADLESS_BUILD)
     // Get the uuid as a string
     godot::String ToGodotString() const;
+#endif
 
     union
     {
@@ -4,6 +4,7 @@
 #include <vector>
 #include <chrono>
 #include <type_traits>
+#include <algorithm>
 
 template<class Type>
 struct get_method_class;
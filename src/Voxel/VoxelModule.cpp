@@ -91,7 +91,7 @@ namespace voxel_game::voxel
 		{
 			godot::Vector3i child_pos = { node_pos.x & 0x1, node_pos.y & 0x1, node_pos.z & 0x1 };
 
-			spatial3d::NodePtr child_node = (node->*&spatial3d::Node::children)[(child_pos.x * 4) + (child_pos.y * 2) + child_pos.z];
+			spatial3d::NodePtr child_node = spatial3d::GetNodeChild(world, node, (child_pos.x * 4) + (child_pos.y * 2) + child_pos.z);
 
 			if (child_node)
 			{
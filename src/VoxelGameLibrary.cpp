@@ -1,6 +1,7 @@
 #include "UniverseServer/UniverseServer.h"
 
 #include "Simulation/SimulationServer.h"
+#include "Simulation/Config.h"
 
 #include "Render/RenderAllocator.h"
 
@@ -28,6 +29,8 @@ void initialize_voxelgame_module(godot::ModuleInitializationLevel p_level)
 	{
 		godot::print_line("Loading voxel world extension");
 
+		voxel_game::simulation::InitializeConfigWriter();
+
 		godot::ClassDB::register_class<voxel_game::CommandWriter>();
 		godot::ClassDB::register_class<voxel_game::CommandServer>();
 		godot::ClassDB::register_class<voxel_game::rendering::AllocatorServer>();
@@ -60,6 +63,9 @@ void uninitialize_voxelgame_module(godot::ModuleInitializationLevel p_level)
 		voxel_game::rendering::AllocatorServer::_cleanup_methods();
 		voxel_game::CommandServer::_cleanup_methods();
 
+		// Simulations are unloaded by now so this only waits for their last saves
+		voxel_game::simulation::UninitializeConfigWriter();
+
 		godot::print_line("Unloaded voxel world extension");
 	}
 }
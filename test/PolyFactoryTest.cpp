@@ -0,0 +1,553 @@
+#include "Util/PolyFactory.h"
+#include "Util/Util.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Checks parts of the PolyFactory that are easy to get subtly wrong. Prints every failed check and
+// returns the number of failures so that it can be run from scripts.
+
+namespace
+{
+	struct CValue
+	{
+		uint64_t value = 0;
+	};
+
+	struct CTag
+	{
+		uint32_t tag = 0;
+	};
+
+	struct CName
+	{
+		std::string name;
+
+		void Serialize(serialize::Writer& writer) const
+		{
+			writer.Write(name.size());
+			writer.WriteBytes(name.data(), name.size());
+		}
+
+		void Deserialize(serialize::Reader& reader)
+		{
+			size_t size;
+			reader.Read(size);
+
+			// Skipping past the end fails the reader
+			if (size > reader.Remaining())
+			{
+				reader.Skip(size);
+				return;
+			}
+
+			name.resize(size);
+			reader.ReadBytes(name.data(), size);
+		}
+	};
+
+	struct TestFactory : PolyFactory<TestFactory, 8, uint64_t> {};
+
+	using Archetype = TestFactory::Archetype;
+
+	size_t failures = 0;
+}
+
+const size_t first = __LINE__ + 1;
+template<> template<> const size_t Archetype::k_type_index<Archetype::Header> =	__LINE__ - first;
+template<> template<> const size_t Archetype::k_type_index<CValue> =			__LINE__ - first;
+template<> template<> const size_t Archetype::k_type_index<CTag> =				__LINE__ - first;
+template<> template<> const size_t Archetype::k_type_index<CName> =				__LINE__ - first;
+
+const std::array<PolyTypeInfo, 8> Archetype::k_type_info =
+{
+	MakeTypeInfo<Archetype::Header>(),
+	MakeTypeInfo<CValue>(),
+	MakeTypeInfo<CTag>(),
+	MakeTypeInfo<CName>(),
+};
+
+#define TEST_CHECK(m_cond) \
+	if (!(m_cond)) \
+	{ \
+		fmt::print("{}:{}: check failed: {}\n", __FILE__, __LINE__, #m_cond); \
+		failures++; \
+	}
+
+namespace
+{
+	// A row that was written after its new chunk last changed should still be found after filling a gap
+	void TestChangedRowMovedIntoOlderChunk()
+	{
+		TestFactory factory;
+		factory.TrackChanges<CValue>();
+
+		std::vector<TestFactory::Ref> refs;
+
+		// Enough polys to need several chunks
+		for (uint64_t i = 1; i <= 5000; i++)
+		{
+			refs.push_back(factory.GetPoly(i, Archetype::CreateTypeID<CValue>()));
+		}
+
+		uint32_t since_tick = factory.GetChangeTick();
+		factory.AdvanceChangeTick();
+
+		// The last row is moved into the gap of the first row when it is removed
+		refs.back().Write<CValue>().value = 1;
+
+		refs.erase(refs.begin());
+		factory.Cleanup();
+
+		std::vector<uint64_t> changed;
+
+		factory.IterateChanged<CValue>(since_tick, [&changed](TestFactory::WeakRef poly)
+		{
+			changed.push_back(poly.GetID());
+		});
+
+		TEST_CHECK(changed.size() == 1);
+		TEST_CHECK(!changed.empty() && changed[0] == 5000);
+
+		refs.clear();
+		factory.Cleanup();
+	}
+
+	// Fill a factory with polys in chunked and individually stored archetypes and snapshot it
+	std::string MakeSnapshot(size_t count)
+	{
+		TestFactory factory;
+		factory.UseChunkedStorage<CValue>();
+
+		std::vector<TestFactory::Ref> refs;
+
+		for (uint64_t i = 1; i <= count; i++)
+		{
+			TestFactory::TypeID types = i % 3 == 0 ? Archetype::CreateTypeID<CValue>() :
+				i % 3 == 1 ? Archetype::CreateTypeID<CValue, CName>() : Archetype::CreateTypeID<CTag, CName>();
+
+			TestFactory::Ref& poly = refs.emplace_back(factory.GetPoly(i, types));
+
+			if (poly.Has<CValue>())
+			{
+				poly->*&CValue::value = i * 7;
+			}
+
+			if (poly.Has<CTag>())
+			{
+				poly->*&CTag::tag = static_cast<uint32_t>(i);
+			}
+
+			if (poly.Has<CName>())
+			{
+				poly->*&CName::name = std::to_string(i);
+			}
+		}
+
+		std::string buffer;
+		serialize::Writer writer(buffer);
+
+		factory.Snapshot(writer);
+
+		refs.clear();
+		factory.Cleanup();
+
+		return buffer;
+	}
+
+	// Restoring a snapshot should give back every poly with the same components and values
+	void TestSnapshotRoundTrip()
+	{
+		const size_t count = 3000;
+
+		std::string buffer = MakeSnapshot(count);
+
+		TestFactory factory;
+		factory.UseChunkedStorage<CValue>();
+
+		std::vector<TestFactory::Ref> refs;
+		serialize::Reader reader(buffer);
+
+		TEST_CHECK(factory.Restore(reader, refs));
+		TEST_CHECK(refs.size() == count);
+		TEST_CHECK(factory.GetCount() == count);
+
+		for (uint64_t i = 1; i <= count; i++)
+		{
+			TestFactory::WeakRef poly = factory.GetPoly(i);
+
+			TEST_CHECK(poly);
+
+			if (!poly)
+			{
+				continue;
+			}
+
+			TEST_CHECK(poly.Has<CValue>() == (i % 3 != 2));
+			TEST_CHECK(poly.Has<CName>() == (i % 3 != 0));
+			TEST_CHECK(poly.Has<CTag>() == (i % 3 == 2));
+
+			// Only archetypes with a component set to chunked storage are chunked
+			TEST_CHECK((poly.GetType()->GetStorage() == PolyStorage::Chunked) == poly.Has<CValue>());
+
+			if (poly.Has<CValue>())
+			{
+				TEST_CHECK(poly->*&CValue::value == i * 7);
+			}
+
+			if (poly.Has<CTag>())
+			{
+				TEST_CHECK(poly->*&CTag::tag == i);
+			}
+
+			if (poly.Has<CName>())
+			{
+				TEST_CHECK(poly->*&CName::name == std::to_string(i));
+			}
+		}
+
+		// Restoring again creates nothing as all the ids exist
+		std::vector<TestFactory::Ref> again;
+		serialize::Reader again_reader(buffer);
+
+		TEST_CHECK(factory.Restore(again_reader, again));
+		TEST_CHECK(again.empty());
+		TEST_CHECK(factory.GetCount() == count);
+
+		refs.clear();
+		factory.Cleanup();
+
+		TEST_CHECK(factory.GetCount() == 0);
+	}
+
+	// Snapshots that end early or claim more polys than they hold should be rejected
+	void TestSnapshotRejected()
+	{
+		std::string buffer = MakeSnapshot(300);
+
+		for (size_t size : { size_t(4), size_t(40), buffer.size() / 2, buffer.size() - 1 })
+		{
+			TestFactory factory;
+			factory.UseChunkedStorage<CValue>();
+
+			std::vector<TestFactory::Ref> refs;
+			serialize::Reader reader(std::string_view(buffer).substr(0, size));
+
+			TEST_CHECK(!factory.Restore(reader, refs));
+
+			refs.clear();
+			factory.Cleanup();
+
+			TEST_CHECK(factory.GetCount() == 0);
+		}
+
+		// A huge poly count right after the first type id
+		const size_t huge_count = SIZE_MAX / sizeof(uint64_t);
+
+		std::string corrupt = buffer.substr(0, sizeof(size_t) * 2 + sizeof(TestFactory::TypeID));
+		corrupt.append(reinterpret_cast<const char*>(&huge_count), sizeof(huge_count));
+
+		TestFactory factory;
+		std::vector<TestFactory::Ref> refs;
+		serialize::Reader reader(corrupt);
+
+		TEST_CHECK(!factory.Restore(reader, refs));
+		TEST_CHECK(refs.empty());
+	}
+
+	// Create polys with a mix of archetypes where every component holds a value derived from the id
+	void FillFactory(TestFactory& factory, std::vector<TestFactory::Ref>& refs, size_t count)
+	{
+		for (uint64_t i = 1; i <= count; i++)
+		{
+			TestFactory::TypeID types = i % 3 == 0 ? Archetype::CreateTypeID<CValue>() :
+				i % 3 == 1 ? Archetype::CreateTypeID<CValue, CName>() : Archetype::CreateTypeID<CTag>();
+
+			TestFactory::Ref& poly = refs.emplace_back(factory.GetPoly(i, types));
+
+			if (poly.Has<CValue>())
+			{
+				poly->*&CValue::value = i * 7;
+			}
+
+			if (poly.Has<CTag>())
+			{
+				poly->*&CTag::tag = static_cast<uint32_t>(i);
+			}
+
+			if (poly.Has<CName>())
+			{
+				poly->*&CName::name = std::to_string(i);
+			}
+		}
+	}
+
+	// Check that two factories hold the same polys with the same components and values
+	void CheckSamePolys(TestFactory& expected, TestFactory& actual, size_t count)
+	{
+		TEST_CHECK(expected.GetCount() == actual.GetCount());
+
+		for (uint64_t i = 1; i <= count; i++)
+		{
+			TestFactory::WeakRef expected_poly = expected.GetPoly(i);
+			TestFactory::WeakRef actual_poly = actual.GetPoly(i);
+
+			TEST_CHECK(expected_poly && actual_poly);
+
+			if (!expected_poly || !actual_poly)
+			{
+				continue;
+			}
+
+			TEST_CHECK(expected_poly.GetType()->GetID() == actual_poly.GetType()->GetID());
+
+			if (expected_poly.Has<CValue>() && actual_poly.Has<CValue>())
+			{
+				TEST_CHECK(expected_poly->*&CValue::value == actual_poly->*&CValue::value);
+			}
+
+			if (expected_poly.Has<CTag>() && actual_poly.Has<CTag>())
+			{
+				TEST_CHECK(expected_poly->*&CTag::tag == actual_poly->*&CTag::tag);
+			}
+
+			if (expected_poly.Has<CName>() && actual_poly.Has<CName>())
+			{
+				TEST_CHECK(expected_poly->*&CName::name == actual_poly->*&CName::name);
+			}
+		}
+	}
+
+	// Changing the types of many polys at once should give the same polys as changing them one by one
+	void TestBatchedTypeChanges(bool chunked)
+	{
+		const size_t count = 2000;
+
+		TestFactory single;
+		TestFactory batched;
+
+		if (chunked)
+		{
+			single.UseChunkedStorage<CValue>();
+			batched.UseChunkedStorage<CValue>();
+		}
+
+		std::vector<TestFactory::Ref> single_refs;
+		std::vector<TestFactory::Ref> batched_refs;
+
+		FillFactory(single, single_refs, count);
+		FillFactory(batched, batched_refs, count);
+
+		// Every other poly plus an id that doesn't exist, which should be skipped
+		std::vector<uint64_t> add_ids;
+
+		for (uint64_t i = 1; i <= count; i += 2)
+		{
+			add_ids.push_back(i);
+		}
+
+		add_ids.push_back(count + 1);
+
+		for (uint64_t id : add_ids)
+		{
+			single.AddTypes<CTag>(id);
+		}
+
+		batched.AddTypes<CTag>(Span<uint64_t>(add_ids.data(), add_ids.size()));
+
+		CheckSamePolys(single, batched, count);
+
+		// Components that are kept should keep their values while CValue is dropped
+		std::vector<uint64_t> set_ids;
+
+		for (uint64_t i = 1; i <= count; i += 3)
+		{
+			set_ids.push_back(i);
+		}
+
+		for (uint64_t id : set_ids)
+		{
+			single.SetTypes<CTag, CName>(id);
+		}
+
+		batched.SetTypes<CTag, CName>(Span<uint64_t>(set_ids.data(), set_ids.size()));
+
+		CheckSamePolys(single, batched, count);
+		TEST_CHECK(batched.GetCount() == count);
+
+		single_refs.clear();
+		batched_refs.clear();
+		single.Cleanup();
+		batched.Cleanup();
+
+		TEST_CHECK(single.GetCount() == 0);
+		TEST_CHECK(batched.GetCount() == 0);
+	}
+
+	// A query should visit the same polys as matching the types on every iteration, both for archetypes
+	// created before and after the query
+	void TestQueryMatchesIterate(bool chunked)
+	{
+		const size_t count = 2000;
+
+		TestFactory factory;
+
+		if (chunked)
+		{
+			factory.UseChunkedStorage<CValue>();
+		}
+
+		const TestFactory::Query& before = factory.AddQuery<CValue>();
+		const TestFactory::Query& excluding = factory.AddQuery(Archetype::CreateTypeID<CValue>(), Archetype::CreateTypeID<CName>());
+
+		std::vector<TestFactory::Ref> refs;
+		FillFactory(factory, refs, count);
+
+		const TestFactory::Query& after = factory.AddQuery<CValue>();
+
+		auto collect = [&factory, chunked](auto&& query, bool skip_names)
+		{
+			std::vector<uint64_t> values;
+
+			if (chunked)
+			{
+				factory.IterateChunks(query, [&values, skip_names](TestFactory::ChunkView view)
+				{
+					if (skip_names && view.Has<CName>())
+					{
+						return;
+					}
+
+					for (const CValue& value : view.Get<CValue>())
+					{
+						values.push_back(value.value);
+					}
+				});
+			}
+			else
+			{
+				factory.Iterate(query, [&values, skip_names](TestFactory::Ptr poly)
+				{
+					if (skip_names && poly.Has<CName>())
+					{
+						return;
+					}
+
+					values.push_back(poly->*&CValue::value);
+				});
+			}
+
+			std::sort(values.begin(), values.end());
+
+			return values;
+		};
+
+		std::vector<uint64_t> expected = collect(Archetype::CreateTypeID<CValue>(), false);
+		std::vector<uint64_t> expected_excluding = collect(Archetype::CreateTypeID<CValue>(), true);
+
+		// Every third id only has CValue, the ids after them also have CName
+		TEST_CHECK(expected.size() == (count + 1) / 3 + count / 3);
+		TEST_CHECK(expected_excluding.size() == count / 3);
+
+		TEST_CHECK(collect(before, false) == expected);
+		TEST_CHECK(collect(after, false) == expected);
+		TEST_CHECK(collect(excluding, false) == expected_excluding);
+
+		refs.clear();
+		factory.Cleanup();
+	}
+
+	struct EventLog
+	{
+		std::vector<uint64_t> single;
+		std::vector<uint64_t> batched;
+		size_t batch_calls = 0;
+	};
+
+	void OnSingleEvent(EventLog& log, TestFactory::WeakRef poly)
+	{
+		log.single.push_back(poly.GetID());
+	}
+
+	void OnBatchEvent(EventLog& log, Span<TestFactory::WeakRef> polys)
+	{
+		log.batch_calls++;
+
+		for (TestFactory::WeakRef poly : polys)
+		{
+			log.batched.push_back(poly.GetID());
+		}
+	}
+
+	// Doing an event for a batch should reach the same callbacks with the same polys as doing it for each poly
+	void TestBatchEventMatchesDoEvent()
+	{
+		const size_t count = 100;
+
+		EventLog log;
+		TestFactory factory;
+
+		// Registered before the archetype exists
+		factory.AddCallback<CValue>(PolyEvent::TaskUpdate, cb::BindArg<&OnSingleEvent>(log));
+
+		std::vector<TestFactory::Ref> refs;
+		std::vector<TestFactory::WeakRef> polys;
+		std::vector<uint64_t> ids;
+
+		for (uint64_t i = 1; i <= count; i++)
+		{
+			polys.push_back(refs.emplace_back(factory.GetPoly(i, Archetype::CreateTypeID<CValue>())));
+			ids.push_back(i);
+		}
+
+		// Registered after the archetype exists
+		factory.AddBatchCallback<CValue>(PolyEvent::TaskUpdate, cb::BindArg<&OnBatchEvent>(log));
+
+		for (TestFactory::WeakRef poly : polys)
+		{
+			factory.DoEvent(PolyEvent::TaskUpdate, poly);
+		}
+
+		TEST_CHECK(log.single == ids);
+		TEST_CHECK(log.batched == ids);
+		TEST_CHECK(log.batch_calls == count);
+
+		log = EventLog();
+
+		factory.DoBatchEvent(PolyEvent::TaskUpdate, Span<TestFactory::WeakRef>(polys.data(), polys.size()));
+
+		TEST_CHECK(log.single == ids);
+		TEST_CHECK(log.batched == ids);
+		TEST_CHECK(log.batch_calls == 1);
+
+		// Other events don't reach the callbacks
+		log = EventLog();
+
+		factory.DoBatchEvent(PolyEvent::MainUpdate, Span<TestFactory::WeakRef>(polys.data(), polys.size()));
+
+		TEST_CHECK(log.single.empty() && log.batched.empty());
+
+		polys.clear();
+		refs.clear();
+		factory.Cleanup();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	TestChangedRowMovedIntoOlderChunk();
+	TestSnapshotRoundTrip();
+	TestSnapshotRejected();
+	TestBatchedTypeChanges(false);
+	TestBatchedTypeChanges(true);
+	TestQueryMatchesIterate(false);
+	TestQueryMatchesIterate(true);
+	TestBatchEventMatchesDoEvent();
+
+	fmt::print("{} failed checks\n", failures);
+
+	return static_cast<int>(failures);
+}
\ No newline at end of file